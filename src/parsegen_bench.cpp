@@ -0,0 +1,141 @@
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "parsegen.hpp"
+#include "parsegen_build_parser.hpp"
+#include "parsegen_xml.hpp"
+#include "parsegen_yaml.hpp"
+
+/* times the two ways build_lalr1_parser can compute lookaheads,
+   lane tracing and DeRemer-Pennello, on the built-in languages and
+   on synthetic expression grammars with many precedence levels, and
+   checks that both give the same tables.
+
+   usage: parsegen-bench [repetitions] */
+
+namespace {
+
+/* a statement language whose expressions have (levels) precedence
+   levels of (ops) left-associative binary operators each */
+parsegen::language make_synthetic_language(int levels, int ops) {
+  parsegen::language l;
+  auto add_token = [&](std::string const& name) {
+    std::string regex;
+    for (auto c : name) {
+      if (!std::isalnum(static_cast<unsigned char>(c))) regex.push_back('\\');
+      regex.push_back(c);
+    }
+    l.tokens.push_back({name, regex});
+  };
+  for (auto name : {"id", "num", "(", ")", ",", ";", "=", "-", "if", "then",
+           "while", "do", "{", "}"}) {
+    add_token(name);
+  }
+  auto op = [](int i, int j) {
+    return "o" + std::to_string(i) + "_" + std::to_string(j);
+  };
+  auto expr = [](int i) { return "e" + std::to_string(i); };
+  for (int i = 0; i < levels; ++i) {
+    for (int j = 0; j < ops; ++j) add_token(op(i, j));
+  }
+  l.productions.push_back({"doc", {"stmts"}});
+  l.productions.push_back({"stmts", {"stmt"}});
+  l.productions.push_back({"stmts", {"stmts", ";", "stmt"}});
+  l.productions.push_back({"stmt", {expr(0)}});
+  l.productions.push_back({"stmt", {"id", "=", expr(0)}});
+  l.productions.push_back({"stmt", {"if", expr(0), "then", "stmt"}});
+  l.productions.push_back(
+      {"stmt", {"while", expr(0), "do", "{", "stmts", "}"}});
+  for (int i = 0; i < levels; ++i) {
+    for (int j = 0; j < ops; ++j) {
+      l.productions.push_back({expr(i), {expr(i), op(i, j), expr(i + 1)}});
+    }
+    l.productions.push_back({expr(i), {expr(i + 1)}});
+  }
+  l.productions.push_back({expr(levels), {"id"}});
+  l.productions.push_back({expr(levels), {"num"}});
+  l.productions.push_back({expr(levels), {"(", expr(0), ")"}});
+  l.productions.push_back({expr(levels), {"id", "(", "args", ")"}});
+  l.productions.push_back({expr(levels), {"-", expr(levels)}});
+  l.productions.push_back({"args", {}});
+  l.productions.push_back({"args", {"arglist"}});
+  l.productions.push_back({"arglist", {expr(0)}});
+  l.productions.push_back({"arglist", {"arglist", ",", expr(0)}});
+  return l;
+}
+
+bool have_same_actions(parsegen::shift_reduce_tables const& a,
+    parsegen::shift_reduce_tables const& b) {
+  using parsegen::action;
+  if (get_nstates(a) != get_nstates(b)) return false;
+  auto const& grammar = *get_grammar(a);
+  for (int state = 0; state < get_nstates(a); ++state) {
+    for (int terminal = 0; terminal < grammar.nterminals; ++terminal) {
+      auto x = get_action(a, state, terminal);
+      auto y = get_action(b, state, terminal);
+      if (x.kind != y.kind) return false;
+      if ((x.kind == action::kind::shift || x.kind == action::kind::reduce) &&
+          x.production != y.production) {
+        return false;
+      }
+    }
+    for (int nt = 0; nt < grammar.nsymbols - grammar.nterminals; ++nt) {
+      if (parsegen::at(a.nonterminal_table, state, nt) !=
+          parsegen::at(b.nonterminal_table, state, nt)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+double time_build(parsegen::grammar_ptr const& grammar,
+    parsegen::lalr1_method method, int repetitions,
+    parsegen::shift_reduce_tables& tables) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < repetitions; ++i) {
+    tables = accept_parser(build_lalr1_parser(grammar, method));
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count() / repetitions;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int repetitions = 1;
+  if (argc > 1) repetitions = std::atoi(argv[1]);
+  if (repetitions < 1) {
+    std::cerr << "usage: " << argv[0] << " [repetitions]\n";
+    return 1;
+  }
+  std::vector<std::pair<std::string, parsegen::language>> languages = {
+      {"math", *parsegen::math_lang::ask_language()},
+      {"xml", *parsegen::xml::ask_language()},
+      {"yaml", *parsegen::yaml::ask_language()},
+      {"regex", *parsegen::regex::ask_language()},
+      {"synthetic-20x5", make_synthetic_language(20, 5)},
+      {"synthetic-40x8", make_synthetic_language(40, 8)},
+      {"synthetic-60x6", make_synthetic_language(60, 6)}};
+  bool all_same = true;
+  std::cout << "language states lane-tracing(s) deremer-pennello(s) same\n";
+  for (auto const& named : languages) {
+    auto grammar = parsegen::build_grammar(named.second);
+    parsegen::shift_reduce_tables lane;
+    parsegen::shift_reduce_tables dp;
+    auto lane_time = time_build(
+        grammar, parsegen::lalr1_method::lane_tracing, repetitions, lane);
+    auto dp_time = time_build(
+        grammar, parsegen::lalr1_method::deremer_pennello, repetitions, dp);
+    bool same = have_same_actions(lane, dp);
+    all_same = all_same && same;
+    std::cout << named.first << ' ' << get_nstates(lane) << ' ' << lane_time
+              << ' ' << dp_time << ' ' << (same ? "yes" : "NO") << '\n';
+  }
+  return all_same ? 0 : 1;
+}
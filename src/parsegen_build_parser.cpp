@@ -1,11 +1,16 @@
 #include "parsegen_build_parser.hpp"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <queue>
+#include <stdexcept>
+#include <unordered_map>
 
 #include "parsegen_parser_graph.hpp"
 #include "parsegen_set.hpp"
@@ -38,65 +43,70 @@ static configurations make_configs(grammar const& g) {
   return configs;
 }
 
-static parser_graph get_left_hand_sides_to_start_configs(
+static csr_graph get_left_hand_sides_to_start_configs(
     configurations const& cs, grammar const& grammar) {
-  auto lhs2sc = make_graph_with_nnodes(grammar.nsymbols);
+  edge_list edges;
   for (int c_i = 0; c_i < isize(cs); ++c_i) {
     auto& c = at(cs, c_i);
     if (c.dot > 0) continue;
     auto p_i = c.production;
     auto& p = at(grammar.productions, p_i);
-    add_edge(lhs2sc, p.lhs, c_i);
+    edges.push_back(std::make_pair(p.lhs, c_i));
   }
-  return lhs2sc;
+  return make_csr_graph(grammar.nsymbols, edges);
 }
 
-struct state_compare {
-  using value_type = state_in_progress const*;
-  bool operator()(value_type const& a, value_type const& b) const {
-    return a->configs < b->configs;
+/* a state is identified by its kernel, the configurations it was
+   made from before closure */
+struct kernel_hash {
+  std::size_t operator()(std::vector<int> const& kernel) const {
+    std::size_t h = kernel.size();
+    for (auto config_i : kernel) {
+      h ^= std::hash<int>()(config_i) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    }
+    return h;
   }
 };
 
-using state_ptr_to_state_index_map = std::map<state_in_progress const*, int, state_compare>;
+using kernel_to_state_map =
+    std::unordered_map<std::vector<int>, int, kernel_hash>;
 
+/* adds to the kernel in (state) the start configurations of every
+   nonterminal that can appear after a dot. (nonterminal_stamps) is a
+   bitset over the nonterminals that is cleared by using a new (stamp)
+   for each closure, so each nonterminal is expanded once. */
 static void close(state_in_progress& state, configurations const& cs,
-    grammar const& grammar, parser_graph const& lhs2sc) {
-  std::queue<int> config_q;
-  std::set<int> config_set;
-  for (auto config_i : state.configs) {
-    config_q.push(config_i);
-    assert(!config_set.count(config_i));
-    config_set.insert(config_i);
-  }
-  while (!config_q.empty()) {
-    auto config_i = config_q.front();
-    config_q.pop();
+    grammar const& grammar, csr_graph const& lhs2sc,
+    std::vector<int>& nonterminal_stamps, int stamp) {
+  std::vector<int> stack;
+  auto visit_symbol_after_dot = [&](int config_i) {
     auto& config = at(cs, config_i);
-    auto prod_i = config.production;
-    auto& prod = at(grammar.productions, prod_i);
-    if (config.dot == isize(prod.rhs)) continue;
+    auto& prod = at(grammar.productions, config.production);
+    if (config.dot == isize(prod.rhs)) return;
     auto symbol_after_dot = at(prod.rhs, config.dot);
-    if (is_terminal(grammar, symbol_after_dot)) continue;
-    for (auto sc : get_edges(lhs2sc, symbol_after_dot)) {
-      if (!config_set.count(sc)) {
-        config_set.insert(sc);
-        config_q.push(sc);
-      }
+    if (is_terminal(grammar, symbol_after_dot)) return;
+    if (at(nonterminal_stamps, symbol_after_dot) == stamp) return;
+    at(nonterminal_stamps, symbol_after_dot) = stamp;
+    stack.push_back(symbol_after_dot);
+  };
+  for (auto config_i : state.configs) visit_symbol_after_dot(config_i);
+  while (!stack.empty()) {
+    auto nonterminal = stack.back();
+    stack.pop_back();
+    for (auto sc : get_edges(lhs2sc, nonterminal)) {
+      state.configs.push_back(sc);
+      visit_symbol_after_dot(sc);
     }
   }
-  state.configs.assign(config_set.begin(), config_set.end());
-}
-
-static void emplace_back(state_in_progress_vector& sips, state_in_progress& sip) {
-  sips.push_back(
-      std::unique_ptr<state_in_progress>(new state_in_progress(std::move(sip))));
+  std::sort(state.configs.begin(), state.configs.end());
+  state.configs.erase(
+      std::unique(state.configs.begin(), state.configs.end()),
+      state.configs.end());
 }
 
 static void add_reduction_actions(
     state_in_progress_vector& states, configurations const& cs, grammar const& grammar) {
-  for (auto& state_uptr : states) {
-    auto& state = *state_uptr;
+  for (auto& state : states) {
     for (auto config_i : state.configs) {
       auto& config = at(cs, config_i);
       auto prod_i = config.production;
@@ -111,8 +121,7 @@ static void add_reduction_actions(
 }
 
 static void set_lr0_contexts(state_in_progress_vector& states, grammar const& grammar) {
-  for (auto& state_uptr : states) {
-    auto& state = *state_uptr;
+  for (auto& state : states) {
     for (auto& action : state.actions) {
       if (action.action.kind != action::kind::reduce) continue;
       if (action.action.production == get_accept_production(grammar)) {
@@ -126,65 +135,59 @@ static void set_lr0_contexts(state_in_progress_vector& states, grammar const& gr
   }
 }
 
-static state_in_progress_vector build_lr0_parser(
-    configurations const& cs, grammar const& grammar, parser_graph const& lhs2sc) {
+static state_in_progress_vector build_lr0_parser(configurations const& cs,
+    grammar const& grammar, csr_graph const& lhs2sc) {
   state_in_progress_vector states;
-  state_ptr_to_state_index_map state_ptrs2idxs;
-  std::queue<int> state_q;
+  kernel_to_state_map kernels2states;
+  auto nonterminal_stamps = make_vector<int>(grammar.nsymbols, -1);
+  /* states are numbered in the order they are found, which is
+     breadth-first since they are expanded in that order below */
+  auto find_or_add_state = [&](std::vector<int>& kernel) {
+    auto it = kernels2states.find(kernel);
+    if (it != kernels2states.end()) return it->second;
+    auto state_i = isize(states);
+    kernels2states.emplace(kernel, state_i);
+    state_in_progress state;
+    state.configs = std::move(kernel);
+    close(state, cs, grammar, lhs2sc, nonterminal_stamps, state_i);
+    states.push_back(std::move(state));
+    return state_i;
+  };
   { /* start state */
-    state_in_progress start_state;
     auto accept_nt = get_accept_nonterminal(grammar);
     /* there should only be one start configuration for the accept symbol */
     auto start_accept_config = get_edges(lhs2sc, accept_nt).front();
-    start_state.configs.push_back(start_accept_config);
-    close(start_state, cs, grammar, lhs2sc);
-    auto start_state_i = isize(states);
-    state_q.push(start_state_i);
-    emplace_back(states, start_state);
-    state_ptrs2idxs[states.back().get()] = start_state_i;
-  }
-  while (!state_q.empty()) {
-    auto state_i = state_q.front();
-    state_q.pop();
-    auto& state = *at(states, state_i);
-    std::set<int> transition_symbols;
-    for (auto config_i : state.configs) {
+    std::vector<int> kernel(1, start_accept_config);
+    find_or_add_state(kernel);
+  }
+  /* (transition symbol, successor config) */
+  std::vector<std::pair<int, int>> transitions;
+  std::vector<int> kernel;
+  for (int state_i = 0; state_i < isize(states); ++state_i) {
+    transitions.clear();
+    for (auto config_i : at(states, state_i).configs) {
       auto& config = at(cs, config_i);
       auto prod_i = config.production;
       auto& prod = at(grammar.productions, prod_i);
       if (config.dot == isize(prod.rhs)) continue;
       auto symbol_after_dot = at(prod.rhs, config.dot);
-      transition_symbols.insert(symbol_after_dot);
+      /* transition successor should just be the next index */
+      transitions.push_back(std::make_pair(symbol_after_dot, config_i + 1));
     }
-    for (auto transition_symbol : transition_symbols) {
-      state_in_progress next_state;
-      for (auto config_i : state.configs) {
-        auto& config = at(cs, config_i);
-        auto prod_i = config.production;
-        auto& prod = at(grammar.productions, prod_i);
-        if (config.dot == isize(prod.rhs)) continue;
-        auto symbol_after_dot = at(prod.rhs, config.dot);
-        if (symbol_after_dot != transition_symbol) continue;
-        /* transition successor should just be the next index */
-        auto next_config_i = config_i + 1;
-        next_state.configs.push_back(next_config_i);
-      }
-      close(next_state, cs, grammar, lhs2sc);
-      auto it = state_ptrs2idxs.find(&next_state);
-      int next_state_i;
-      if (it == state_ptrs2idxs.end()) {
-        next_state_i = isize(states);
-        state_q.push(next_state_i);
-        emplace_back(states, next_state);
-        state_ptrs2idxs[states.back().get()] = next_state_i;
-      } else {
-        next_state_i = it->second;
+    std::sort(transitions.begin(), transitions.end());
+    for (int i = 0; i < isize(transitions);) {
+      auto transition_symbol = at(transitions, i).first;
+      kernel.clear();
+      for (; i < isize(transitions) && at(transitions, i).first == transition_symbol; ++i) {
+        kernel.push_back(at(transitions, i).second);
       }
+      /* may grow (states), so no references into it are held here */
+      auto next_state_i = find_or_add_state(kernel);
       action_in_progress transition;
       transition.action.kind = action::kind::shift;
       transition.action.next_state = next_state_i;
       transition.context.insert(transition_symbol);
-      state.actions.emplace_back(std::move(transition));
+      at(states, state_i).actions.emplace_back(std::move(transition));
     }
   }
   add_reduction_actions(states, cs, grammar);
@@ -192,180 +195,250 @@ static state_in_progress_vector build_lr0_parser(
   return states;
 }
 
-static parser_graph get_productions_by_lhs(grammar const& grammar) {
-  auto nsymbols = grammar.nsymbols;
-  auto lhs2prods = make_graph_with_nnodes(nsymbols);
-  for (int prod_i = 0; prod_i < isize(grammar.productions); ++prod_i) {
-    auto& prod = at(grammar.productions, prod_i);
-    add_edge(lhs2prods, prod.lhs, prod_i);
-  }
-  return lhs2prods;
-}
-
-/* compute a graph where symbols are graph nodes, and
-   there exists an edge (A, B) if B appears in the RHS of
-   any production in which A is the LHS */
-static parser_graph get_symbol_graph(
-    grammar const& grammar, parser_graph const& lhs2prods) {
-  auto nsymbols = grammar.nsymbols;
-  auto out = make_graph_with_nnodes(nsymbols);
-  for (int lhs = 0; lhs < nsymbols; ++lhs) {
-    std::set<int> dependees;
-    auto& lhs_prods = get_edges(lhs2prods, lhs);
-    for (auto prod_i : lhs_prods) {
-      auto& prod = at(grammar.productions, prod_i);
-      for (auto rhs_symb : prod.rhs) {
-        dependees.insert(rhs_symb);
-      }
-    }
-    at(out, lhs).assign(dependees.begin(), dependees.end());
-  }
-  return out;
-}
-
 /* the "FIRST" set, i.e. the set of 1-heads of non-null terminal descendants of
    some string.
    As suggested by Westley Weimer here:
    https://www.cs.virginia.edu/~weimer/2008-415/reading/FirstFollowLL.pdf
    we will also use the FIRST set for determining whether the string has
-   a null terminal descendant, indicated by the prescence of a special
-   FIRST_NULL symbol in the FIRST set */
-enum { FIRST_NULL = -425 };
-using first_set_type = std::set<int>;
+   a null terminal descendant, which is the has_null flag */
+struct first_set_type {
+  symbol_set terminals;
+  bool has_null = false;
+};
 
-static void print_set(std::set<int> const& set, grammar const& grammar) {
+template <typename Set>
+static void print_set(Set const& set, grammar const& grammar) {
   std::cerr << "{";
   for (auto it = set.begin(); it != set.end(); ++it) {
     if (it != set.begin()) std::cerr << ", ";
-    auto symb = *it;
-    if (symb == FIRST_NULL)
-      std::cerr << "null";
-    else {
-      auto& symb_name = at(grammar.symbol_names, symb);
-      if (symb_name == ",")
-        std::cerr << "','";
-      else
-        std::cerr << symb_name;
-    }
+    auto& symb_name = at(grammar.symbol_names, *it);
+    if (symb_name == ",")
+      std::cerr << "','";
+    else
+      std::cerr << symb_name;
+  }
+  std::cerr << "}";
+}
+
+static void print_first_set(
+    first_set_type const& first_set, grammar const& grammar) {
+  if (!first_set.has_null) {
+    print_set(first_set.terminals, grammar);
+    return;
+  }
+  std::cerr << "{null";
+  for (auto symb : first_set.terminals) {
+    std::cerr << ", ";
+    auto& symb_name = at(grammar.symbol_names, symb);
+    if (symb_name == ",")
+      std::cerr << "','";
+    else
+      std::cerr << symb_name;
   }
   std::cerr << "}";
 }
 
-static first_set_type get_first_set_of_string(
-    std::vector<int> const& string, std::vector<first_set_type> const& first_sets) {
-  first_set_type out;
-  /* walk the string, stop when any symbol is found that doesn't
-     have a null terminal descendant */
-  int i;
-  for (i = 0; i < isize(string); ++i) {
-    auto symbol = at(string, i);
-    bool has_null = false;
-    for (auto first_symbol : at(first_sets, symbol)) {
-      if (first_symbol == FIRST_NULL)
-        has_null = true;
-      else
-        out.insert(first_symbol);
+/* Tarjan's algorithm, without recursion.
+   The components are listed in the order they are completed, which is
+   a reverse topological order: each component comes after all the
+   components it has edges to. */
+static parser_graph get_strongly_connected_components(csr_graph const& g) {
+  auto nnodes = get_nnodes(g);
+  auto index = make_vector<int>(nnodes, -1);
+  auto lowlink = make_vector<int>(nnodes, -1);
+  auto on_stack = make_vector<bool>(nnodes, false);
+  std::vector<int> stack;
+  /* (node, next edge to follow) */
+  std::vector<std::pair<int, int>> call_stack;
+  parser_graph components;
+  int next_index = 0;
+  auto visit = [&](int node) {
+    at(index, node) = at(lowlink, node) = next_index++;
+    stack.push_back(node);
+    at(on_stack, node) = true;
+    call_stack.push_back(std::make_pair(node, 0));
+  };
+  for (int root = 0; root < nnodes; ++root) {
+    if (at(index, root) != -1) continue;
+    visit(root);
+    while (!call_stack.empty()) {
+      auto node = call_stack.back().first;
+      auto edges = get_edges(g, node);
+      auto edge_i = call_stack.back().second;
+      if (edge_i < edges.size()) {
+        ++call_stack.back().second;
+        auto next = edges[edge_i];
+        if (at(index, next) == -1) {
+          visit(next);
+        } else if (at(on_stack, next)) {
+          at(lowlink, node) = std::min(at(lowlink, node), at(index, next));
+        }
+        continue;
+      }
+      call_stack.pop_back();
+      if (!call_stack.empty()) {
+        auto parent = call_stack.back().first;
+        at(lowlink, parent) = std::min(at(lowlink, parent), at(lowlink, node));
+      }
+      if (at(lowlink, node) != at(index, node)) continue;
+      components.emplace_back();
+      int member;
+      do {
+        member = stack.back();
+        stack.pop_back();
+        at(on_stack, member) = false;
+        components.back().push_back(member);
+      } while (member != node);
     }
-    if (!has_null) break;
   }
-  if (i == isize(string)) out.insert(FIRST_NULL);
-  return out;
+  return components;
 }
 
-/* figure out the FIRST sets for each non-terminal in the grammar.
-   I couldn't find a super-efficient way to do this, so here is a
-   free-for-all event-driven implementation. */
+/* a production is nullable once all its RHS symbols are, so count
+   down the RHS symbols not yet known to be nullable, and each time a
+   nonterminal is found nullable visit the productions it appears in */
+static std::vector<bool> compute_nullable(grammar const& grammar) {
+  auto nsymbols = grammar.nsymbols;
+  auto nullable = make_vector<bool>(nsymbols, false);
+  edge_list rhs_edges;
+  std::vector<int> nremaining;
+  reserve(nremaining, isize(grammar.productions));
+  std::vector<int> found;
+  for (int prod_i = 0; prod_i < isize(grammar.productions); ++prod_i) {
+    auto& prod = at(grammar.productions, prod_i);
+    nremaining.push_back(isize(prod.rhs));
+    for (auto symbol : prod.rhs) {
+      rhs_edges.push_back(std::make_pair(symbol, prod_i));
+    }
+    if (prod.rhs.empty() && !at(nullable, prod.lhs)) {
+      at(nullable, prod.lhs) = true;
+      found.push_back(prod.lhs);
+    }
+  }
+  auto rhs2prods = make_csr_graph(nsymbols, rhs_edges);
+  while (!found.empty()) {
+    auto symbol = found.back();
+    found.pop_back();
+    for (auto prod_i : get_edges(rhs2prods, symbol)) {
+      if (--at(nremaining, prod_i) != 0) continue;
+      auto lhs = at(grammar.productions, prod_i).lhs;
+      if (at(nullable, lhs)) continue;
+      at(nullable, lhs) = true;
+      found.push_back(lhs);
+    }
+  }
+  return nullable;
+}
+
+/* figure out the FIRST sets for each symbol in the grammar.
+   FIRST(A) is the union of FIRST(X) over all symbols X that follow a
+   nullable prefix of the RHS of a production of A. In the graph of
+   those (A, X) dependencies, all the nonterminals in one strongly
+   connected component have the same FIRST set, so visiting the
+   components in reverse topological order gives each FIRST set with
+   one union per edge and no iteration. */
 static std::vector<first_set_type> compute_first_sets(
     grammar const& grammar, bool verbose) {
   if (verbose) std::cerr << "computing FIRST sets...\n";
-  struct event {
-    int added_symbol;
-    int dependee;
-  };
-  std::queue<event> event_q;
   auto nsymbols = grammar.nsymbols;
   auto first_sets = make_vector<first_set_type>(nsymbols);
-  auto lhs2prods = get_productions_by_lhs(grammar);
+  auto nullable = compute_nullable(grammar);
+  edge_list dependencies;
+  for (auto& prod : grammar.productions) {
+    for (auto symbol : prod.rhs) {
+      dependencies.push_back(std::make_pair(prod.lhs, symbol));
+      if (!at(nullable, symbol)) break;
+    }
+  }
+  auto depends_on = make_csr_graph(nsymbols, dependencies);
   for (int symbol = 0; symbol < nsymbols; ++symbol) {
     if (is_terminal(grammar, symbol)) {
-      event_q.push({symbol, symbol});
-    } else {
-      auto& lhs_prods = get_edges(lhs2prods, symbol);
-      for (auto prod_i : lhs_prods) {
-        auto& prod = at(grammar.productions, prod_i);
-        if (prod.rhs.empty()) {
-          event_q.push({FIRST_NULL, symbol});
-          break;
-        }
-      }
+      at(first_sets, symbol).terminals.insert(symbol);
     }
+    at(first_sets, symbol).has_null = at(nullable, symbol);
   }
-  auto dependers2dependees = get_symbol_graph(grammar, lhs2prods);
-  auto dependees2dependers = make_transpose(dependers2dependees);
-  while (!event_q.empty()) {
-    auto event = event_q.front();
-    event_q.pop();
-    auto added_symb = event.added_symbol;
-    auto dependee = event.dependee;
-    auto& dependee_firsts = at(first_sets, dependee);
-    /* hopefully we don't get too many duplicate events piled up... */
-    if (dependee_firsts.count(added_symb)) continue;
-    dependee_firsts.insert(added_symb);
-    auto& dependers = get_edges(dependees2dependers, dependee);
-    for (auto depender : dependers) {
-      assert(is_nonterminal(grammar, depender));
-      auto& prods = get_edges(lhs2prods, depender);
-      auto const& depender_firsts = at(first_sets, depender);
-      for (auto prod_i : prods) {
-        auto& prod = at(grammar.productions, prod_i);
-        auto rhs_first_set = get_first_set_of_string(prod.rhs, first_sets);
-        for (auto rhs_first_symb : rhs_first_set) {
-          if (!depender_firsts.count(rhs_first_symb)) {
-            event_q.push({rhs_first_symb, depender});
-          }
-        }
+  auto components = get_strongly_connected_components(depends_on);
+  auto component_of = make_vector<int>(nsymbols, -1);
+  for (int comp_i = 0; comp_i < isize(components); ++comp_i) {
+    for (auto symbol : get_edges(components, comp_i)) {
+      at(component_of, symbol) = comp_i;
+    }
+  }
+  for (int comp_i = 0; comp_i < isize(components); ++comp_i) {
+    auto& members = get_edges(components, comp_i);
+    symbol_set terminals;
+    for (auto symbol : members) {
+      if (is_terminal(grammar, symbol)) continue;
+      for (auto dependee : get_edges(depends_on, symbol)) {
+        if (at(component_of, dependee) == comp_i) continue;
+        unite_with(terminals, at(first_sets, dependee).terminals);
       }
     }
+    for (auto symbol : members) {
+      if (is_terminal(grammar, symbol)) continue;
+      at(first_sets, symbol).terminals = terminals;
+    }
   }
   if (verbose) {
     for (int symb = 0; symb < nsymbols; ++symb) {
       auto& symb_name = at(grammar.symbol_names, symb);
-      std::cerr << "FIRST(" << symb_name << ") = {";
-      auto& c = at(first_sets, symb);
-      for (auto it = c.begin(); it != c.end(); ++it) {
-        if (it != c.begin()) std::cerr << ", ";
-        auto first_symb = *it;
-        if (first_symb == FIRST_NULL) {
-          std::cerr << "null";
-        } else {
-          auto& first_name = at(grammar.symbol_names, first_symb);
-          std::cerr << first_name;
-        }
-      }
-      std::cerr << "}\n";
+      std::cerr << "FIRST(" << symb_name << ") = ";
+      print_first_set(at(first_sets, symb), grammar);
+      std::cerr << "\n";
     }
     std::cerr << '\n';
   }
   return first_sets;
 }
 
+/* memoized FIRST sets of the FOLLOW string of each configuration,
+   i.e. of the part of the RHS after the symbol at the dot, which lane
+   tracing asks for over and over. The configurations of a production
+   are consecutive with increasing dot, so each one is computed from
+   the next one. */
+static std::vector<first_set_type> compute_follow_first_sets(
+    configurations const& cs, grammar const& grammar,
+    std::vector<first_set_type> const& first_sets) {
+  auto out = make_vector<first_set_type>(isize(cs));
+  for (int c_i = isize(cs) - 1; c_i >= 0; --c_i) {
+    auto& config = at(cs, c_i);
+    auto& prod = at(grammar.productions, config.production);
+    auto& follow_first = at(out, c_i);
+    if (config.dot + 1 >= isize(prod.rhs)) {
+      follow_first.has_null = true;
+      continue;
+    }
+    auto& symbol_first = at(first_sets, at(prod.rhs, config.dot + 1));
+    follow_first.terminals = symbol_first.terminals;
+    if (symbol_first.has_null) {
+      auto& rest = at(out, c_i + 1);
+      assert(at(cs, c_i + 1).production == config.production);
+      assert(at(cs, c_i + 1).dot == config.dot + 1);
+      unite_with(follow_first.terminals, rest.terminals);
+      follow_first.has_null = rest.has_null;
+    }
+  }
+  return out;
+}
+
 state_configurations form_state_configs(state_in_progress_vector const& states) {
   state_configurations out;
   for (int i = 0; i < isize(states); ++i) {
-    auto& state = *at(states, i);
+    auto& state = at(states, i);
     for (int j = 0; j < isize(state.configs); ++j) out.push_back({i, j});
   }
   return out;
 }
 
-parser_graph form_states_to_state_configs(
+csr_graph form_states_to_state_configs(
     state_configurations const& scs, state_in_progress_vector const& states) {
-  auto out = make_graph_with_nnodes(size(states));
+  edge_list edges;
+  reserve(edges, isize(scs));
   for (int i = 0; i < isize(scs); ++i) {
     auto& sc = at(scs, i);
-    at(out, sc.state).push_back(i);
+    edges.push_back(std::make_pair(sc.state, i));
   }
-  return out;
+  return make_csr_graph(isize(states), edges);
 }
 
 static std::string escape_dot(std::string const& s) {
@@ -396,7 +469,7 @@ void print_dot(std::string const& filepath, parser_in_progress const& pip) {
   file << "rankdir = \"LR\"\n";
   file << "]\n";
   for (int s_i = 0; s_i < isize(sips); ++s_i) {
-    auto& state = *at(sips, s_i);
+    auto& state = at(sips, s_i);
     file << s_i << " [\n";
     file << "label = \"";
     file << "State " << s_i << "\\l";
@@ -458,12 +531,12 @@ void print_dot(std::string const& filepath, parser_in_progress const& pip) {
   file << "}\n";
 }
 
-static parser_graph make_immediate_predecessor_graph(state_configurations const& scs,
-    state_in_progress_vector const& states, parser_graph const& states2scs,
+static csr_graph make_immediate_predecessor_graph(state_configurations const& scs,
+    state_in_progress_vector const& states, csr_graph const& states2scs,
     configurations const& cs, grammar_ptr grammar) {
-  auto out = make_graph_with_nnodes(size(scs));
+  edge_list edges;
   for (int s_i = 0; s_i < isize(states); ++s_i) {
-    auto& state = *at(states, s_i);
+    auto& state = at(states, s_i);
     for (int cis_i = 0; cis_i < isize(state.configs); ++cis_i) {
       auto config_i = at(state.configs, cis_i);
       auto& config = at(cs, config_i);
@@ -479,26 +552,26 @@ static parser_graph make_immediate_predecessor_graph(state_configurations const&
         if (prod2.lhs == s) {
           auto sc_i = at(states2scs, s_i, cis_i);
           auto sc_j = at(states2scs, s_i, cis_j);
-          add_edge(out, sc_j, sc_i);
+          edges.push_back(std::make_pair(sc_j, sc_i));
         }
       }
     }
   }
-  return out;
+  return make_csr_graph(isize(scs), edges);
 }
 
-static parser_graph find_transition_predecessors(state_configurations const& scs,
-    state_in_progress_vector const& states, parser_graph const& states2scs,
+static csr_graph find_transition_predecessors(state_configurations const& scs,
+    state_in_progress_vector const& states, csr_graph const& states2scs,
     configurations const& cs, grammar_ptr grammar) {
-  auto out = make_graph_with_nnodes(size(scs));
+  edge_list edges;
   for (int state_i = 0; state_i < isize(states); ++state_i) {
-    auto& state = *at(states, state_i);
+    auto& state = at(states, state_i);
     for (auto& action : state.actions) {
       if (action.action.kind != action::kind::shift) continue;
       assert(action.context.size() == 1);
       auto symbol = *(action.context.begin());
       auto state_j = action.action.next_state;
-      auto& state2 = *at(states, state_j);
+      auto& state2 = at(states, state_j);
       for (int cis_i = 0; cis_i < isize(state.configs); ++cis_i) {
         auto config_i = at(state.configs, cis_i);
         auto& config = at(cs, config_i);
@@ -512,53 +585,64 @@ static parser_graph find_transition_predecessors(state_configurations const& scs
             if (rhs_symbol == symbol) {
               auto sc_i = at(states2scs, state_i, cis_i);
               auto sc_j = at(states2scs, state_j, cis_j);
-              add_edge(out, sc_j, sc_i);
+              edges.push_back(std::make_pair(sc_j, sc_i));
             }
           }
         }
       }
     }
   }
-  return out;
+  return make_csr_graph(isize(scs), edges);
 }
 
-static parser_graph make_originator_graph(state_configurations const& scs,
-    state_in_progress_vector const& states, parser_graph const& states2scs,
+static csr_graph make_originator_graph(state_configurations const& scs,
+    state_in_progress_vector const& states, csr_graph const& states2scs,
     configurations const& cs, grammar_ptr grammar) {
-  auto out = make_graph_with_nnodes(size(scs));
   auto ipg =
       make_immediate_predecessor_graph(scs, states, states2scs, cs, grammar);
   auto tpg = find_transition_predecessors(scs, states, states2scs, cs, grammar);
+  edge_list edges;
+  /* stamps mark the nodes already visited by the search from sc_i */
+  auto tp_stamps = make_vector<int>(isize(scs), -1);
+  std::vector<int> tpq;
+  std::vector<int> originators;
   for (auto sc_i = 0; sc_i < isize(scs); ++sc_i) {
-    std::set<int> originators;
     /* breadth-first search through the transition
        precessor graph, followed by a single hop
        along the immediate predecessor graph */
-    std::queue<int> tpq;
-    std::set<int> tps;
-    tpq.push(sc_i);
-    tps.insert(sc_i);
-    while (!tpq.empty()) {
-      auto tpp = tpq.front();
-      tpq.pop();
+    originators.clear();
+    tpq.clear();
+    tpq.push_back(sc_i);
+    at(tp_stamps, sc_i) = sc_i;
+    for (int front = 0; front < isize(tpq); ++front) {
+      auto tpp = at(tpq, front);
       for (auto tpc : get_edges(tpg, tpp)) {
-        if (tps.count(tpc)) continue;
-        tpq.push(tpc);
-        tps.insert(tpc);
+        if (at(tp_stamps, tpc) == sc_i) continue;
+        at(tp_stamps, tpc) = sc_i;
+        tpq.push_back(tpc);
       }
       for (auto ip_i : get_edges(ipg, tpp)) {
-        originators.insert(ip_i);
+        originators.push_back(ip_i);
       }
     }
-    at(out, sc_i).assign(originators.begin(), originators.end());
+    std::sort(originators.begin(), originators.end());
+    originators.erase(std::unique(originators.begin(), originators.end()),
+        originators.end());
+    for (auto ip_i : originators) edges.push_back(std::make_pair(sc_i, ip_i));
   }
-  return out;
+  return make_csr_graph(isize(scs), edges);
+}
+
+static int get_config(int sc_addr, state_configurations const& scs,
+    state_in_progress_vector const& states) {
+  auto& sc = at(scs, sc_addr);
+  return at(at(states, sc.state).configs, sc.config_in_state);
 }
 
 static std::vector<int> get_follow_string(int sc_addr, state_configurations const& scs,
     state_in_progress_vector const& states, configurations const& cs, grammar_ptr grammar) {
   auto& sc = at(scs, sc_addr);
-  auto& state = *at(states, sc.state);
+  auto& state = at(states, sc.state);
   auto config_i = at(state.configs, sc.config_in_state);
   auto& config = at(cs, config_i);
   auto& prod = at(grammar->productions, config.production);
@@ -583,15 +667,11 @@ static void print_string(std::vector<int> const& str, grammar_ptr grammar) {
 }
 
 static bool has_non_null_terminal_descendant(first_set_type const& first_set) {
-  if (first_set.empty()) return false;
-  if (first_set.size() > 1) return true;
-  return *(first_set.begin()) != FIRST_NULL;
+  return !first_set.terminals.empty();
 }
 
-static context_type get_contexts(first_set_type first_set) {
-  auto it = first_set.find(FIRST_NULL);
-  if (it != first_set.end()) first_set.erase(it);
-  return first_set;
+static context_type get_contexts(first_set_type const& first_set) {
+  return first_set.terminals;
 }
 
 enum { MARKER = -433 };
@@ -708,7 +788,11 @@ static void deal_with_tests_failed(int& num_originators_failed,
     if (verbose)
       std::cerr << "    the first was " << zeta_double_prime_addr << '\n';
     assert(at(lane, isize(lane) - 1) == zeta_double_prime_addr);
-    assert(at(lane, isize(lane) - 2) == zeta_addr);
+    /* move_markers may have put markers between them */
+    auto below = isize(lane) - 2;
+    while (at(lane, below) == MARKER) --below;
+    assert(at(lane, below) == zeta_addr);
+    (void)below;
     if (verbose)
       std::cerr << "    pop LANE, push {marker, " << zeta_double_prime_addr
                 << "} onto it:\n    ";
@@ -737,10 +821,10 @@ static void deal_with_tests_failed(int& num_originators_failed,
 
 static void heuristic_propagation_of_context_sets(int tau_addr,
     context_types& contexts, std::vector<bool>& complete, state_configurations const& scs,
-    state_in_progress_vector const& states, parser_graph const& states2scs,
+    state_in_progress_vector const& states, csr_graph const& states2scs,
     configurations const& cs, grammar_ptr grammar) {
   auto& tau = at(scs, tau_addr);
-  auto& state = *at(states, tau.state);
+  auto& state = at(states, tau.state);
   auto config_i = at(state.configs, tau.config_in_state);
   auto& config = at(cs, config_i);
   if (config.dot != 0) return;
@@ -762,9 +846,10 @@ static void heuristic_propagation_of_context_sets(int tau_addr,
    Figure 7 of David Pager's paper. */
 static void compute_context_set(int zeta_j_addr, context_types& contexts,
     std::vector<bool>& complete, state_configurations const& scs,
-    parser_graph const& originator_graph, state_in_progress_vector const& states,
-    parser_graph const& states2scs, configurations const& cs,
-    std::vector<first_set_type> const& first_sets, grammar_ptr grammar, bool verbose) {
+    csr_graph const& originator_graph, state_in_progress_vector const& states,
+    csr_graph const& states2scs, configurations const& cs,
+    std::vector<first_set_type> const& follow_first_sets, grammar_ptr grammar,
+    bool verbose) {
   if (verbose)
     std::cerr << "Computing context set for $\\zeta_j$ = " << zeta_j_addr
               << "...\n";
@@ -803,19 +888,22 @@ static void compute_context_set(int zeta_j_addr, context_types& contexts,
         std::cerr << "Next originator of $\\zeta$ = " << zeta_addr
                   << " is $\\zeta'$ = " << zeta_prime_addr << '\n';
       }
-      auto gamma = get_follow_string(zeta_prime_addr, scs, states, cs, grammar);
+      /* the FOLLOW string itself is only needed for printing */
+      std::vector<int> gamma;
       if (verbose) {
+        gamma = get_follow_string(zeta_prime_addr, scs, states, cs, grammar);
         std::cerr << "  FOLLOW string of $\\zeta'$ = " << zeta_prime_addr
                   << " is ";
         print_string(gamma, grammar);
         std::cerr << '\n';
       }
-      auto gamma_first = get_first_set_of_string(gamma, first_sets);
+      auto& gamma_first =
+          at(follow_first_sets, get_config(zeta_prime_addr, scs, states));
       if (verbose) {
         std::cerr << "  FIRST set of ";
         print_string(gamma, grammar);
         std::cerr << " is ";
-        print_set(gamma_first, *grammar);
+        print_first_set(gamma_first, *grammar);
         std::cerr << "\n";
       }
       if (has_non_null_terminal_descendant(gamma_first)) {  // test A
@@ -832,7 +920,7 @@ static void compute_context_set(int zeta_j_addr, context_types& contexts,
           print_string(gamma, grammar);
           std::cerr << '\n';
         }
-        if (gamma_first.count(FIRST_NULL)) {
+        if (gamma_first.has_null) {
           if (verbose) {
             std::cerr << "  ";
             print_string(gamma, grammar);
@@ -969,11 +1057,62 @@ static void compute_context_set(int zeta_j_addr, context_types& contexts,
   }      // end top-level while(1) loop
 }
 
+/* how the precedence levels resolve a conflict between shifting
+   (terminal) and reducing by (production): the one binding tighter
+   wins, and on the same level the associativity decides, with none
+   making (terminal) an error there. Returns false if either has no
+   level, and the conflict stays one. */
+static bool resolve_by_precedence(grammar const& grammar, int terminal,
+    int production, enum action::kind& kind) {
+  if (grammar.terminal_precedences.empty()) return false;
+  auto terminal_level = at(grammar.terminal_precedences, terminal);
+  auto production_level = at(grammar.productions, production).precedence;
+  if (terminal_level == -1 || production_level == -1) return false;
+  if (terminal_level != production_level) {
+    kind = (terminal_level > production_level) ? action::kind::shift
+                                               : action::kind::reduce;
+    return true;
+  }
+  switch (at(grammar.associativities, terminal_level)) {
+    case associativity::left:
+      kind = action::kind::reduce;
+      break;
+    case associativity::right:
+      kind = action::kind::shift;
+      break;
+    case associativity::nonassoc:
+      kind = action::kind::none;
+      break;
+  }
+  return true;
+}
+
+/* the winner of two actions on (terminal), one of them a shift and
+   the other a reduction, which have no conflict by resolve_by_precedence */
+static action resolve_conflict(grammar const& grammar, int terminal,
+    action const& a, action const& b) {
+  auto& shift = (a.kind == action::kind::shift) ? a : b;
+  auto& reduce = (a.kind == action::kind::shift) ? b : a;
+  assert(shift.kind == action::kind::shift);
+  assert(reduce.kind == action::kind::reduce);
+  action out;
+  auto resolved =
+      resolve_by_precedence(grammar, terminal, reduce.production, out.kind);
+  assert(resolved);
+  (void)resolved;
+  if (out.kind == action::kind::shift) return shift;
+  if (out.kind == action::kind::reduce) return reduce;
+  return out;
+}
+
+/* with (uses_precedence), the shift/reduce conflicts that precedence
+   resolves do not make a state inadequate */
 static std::vector<bool> determine_adequate_states(
-    state_in_progress_vector const& states, grammar_ptr grammar, bool verbose) {
+    state_in_progress_vector const& states, grammar_ptr grammar,
+    bool uses_precedence, bool verbose) {
   auto out = make_vector<bool>(size(states));
   for (int s_i = 0; s_i < isize(states); ++s_i) {
-    auto& state = *at(states, s_i);
+    auto& state = at(states, s_i);
     bool state_is_adequate = true;
     for (int a_i = 0; a_i < isize(state.actions); ++a_i) {
       auto& action = at(state.actions, a_i);
@@ -988,6 +1127,17 @@ static std::vector<bool> determine_adequate_states(
           continue;
         }
         if (intersects(action2.context, action.context)) {
+          if (uses_precedence &&
+              action.action.kind != action2.action.kind) {
+            auto is_shift = action.action.kind == action::kind::shift;
+            auto& shift = is_shift ? action : action2;
+            auto& reduce = is_shift ? action2 : action;
+            enum action::kind kind;
+            if (resolve_by_precedence(*grammar, *(shift.context.begin()),
+                    reduce.action.production, kind)) {
+              continue;
+            }
+          }
           if (verbose) {
             auto* ap1 = &action;
             auto* ap2 = &action2;
@@ -1020,26 +1170,15 @@ static std::vector<bool> determine_adequate_states(
   return out;
 }
 
-parser_in_progress build_lalr1_parser(grammar_ptr grammar, bool verbose) {
-  parser_in_progress out;
-  auto& cs = out.configs;
-  auto& states = out.states;
-  auto& scs = out.state_configs;
-  auto& states2scs = out.states2state_configs;
-  out.grammar = grammar;
-  cs = make_configs(*grammar);
-  auto lhs2cs = get_left_hand_sides_to_start_configs(cs, *grammar);
-  if (verbose) std::cerr << "Building LR(0) parser\n";
-  states = build_lr0_parser(cs, *grammar, lhs2cs);
-  scs = form_state_configs(states);
-  states2scs = form_states_to_state_configs(scs, states);
-  if (verbose) print_dot("lr0.dot", out);
-  if (verbose) std::cerr << "Checking adequacy of LR(0) machine\n";
-  auto adequate = determine_adequate_states(states, grammar, verbose);
-  if (*(std::min_element(adequate.begin(), adequate.end()))) {
-    if (verbose) std::cerr << "The grammar is LR(0)!\n";
-    return out;
-  }
+/* Pager's lane tracing: the contexts of the reductions in inadequate
+   states are computed one at a time, following lanes backwards */
+static void trace_lanes(parser_in_progress& pip,
+    std::vector<bool> const& adequate, bool verbose) {
+  auto& cs = pip.configs;
+  auto& states = pip.states;
+  auto& scs = pip.state_configs;
+  auto& states2scs = pip.states2state_configs;
+  auto& grammar = pip.grammar;
   auto complete = make_vector<bool>(size(scs), false);
   auto contexts = make_vector<context_type>(size(scs));
   auto accept_prod_i = get_accept_production(*grammar);
@@ -1047,7 +1186,7 @@ parser_in_progress build_lalr1_parser(grammar_ptr grammar, bool verbose) {
      footnote 8 at the bottom of page 37 */
   for (int sc_i = 0; sc_i < isize(scs); ++sc_i) {
     auto& sc = at(scs, sc_i);
-    auto& state = *at(states, sc.state);
+    auto& state = at(states, sc.state);
     auto config_i = at(state.configs, sc.config_in_state);
     auto& config = at(cs, config_i);
     if (config.production == accept_prod_i) {
@@ -1059,11 +1198,12 @@ parser_in_progress build_lalr1_parser(grammar_ptr grammar, bool verbose) {
   if (verbose) std::cerr << "Originator parser_graph:\n";
   if (verbose) std::cerr << og << '\n';
   auto first_sets = compute_first_sets(*grammar, verbose);
+  auto follow_first_sets = compute_follow_first_sets(cs, *grammar, first_sets);
   /* compute context sets for all state-configs associated with reduction
      actions that are part of an inadequate state */
   for (int s_i = 0; s_i < isize(states); ++s_i) {
     if (at(adequate, s_i)) continue;
-    auto& state = *at(states, s_i);
+    auto& state = at(states, s_i);
     for (int cis_i = 0; cis_i < isize(state.configs); ++cis_i) {
       auto config_i = at(state.configs, cis_i);
       auto& config = at(cs, config_i);
@@ -1071,13 +1211,13 @@ parser_in_progress build_lalr1_parser(grammar_ptr grammar, bool verbose) {
       if (config.dot != isize(prod.rhs)) continue;
       auto zeta_j_addr = at(states2scs, s_i, cis_i);
       compute_context_set(zeta_j_addr, contexts, complete, scs, og, states,
-          states2scs, cs, first_sets, grammar, verbose);
+          states2scs, cs, follow_first_sets, grammar, verbose);
     }
   }
   /* update the context sets for all reduction state-configs
      which are marked complete, even if they aren't in inadequate states */
   for (int s_i = 0; s_i < isize(states); ++s_i) {
-    auto& state = *at(states, s_i);
+    auto& state = at(states, s_i);
     for (int cis_i = 0; cis_i < isize(state.configs); ++cis_i) {
       auto sc_i = at(states2scs, s_i, cis_i);
       if (!at(complete, sc_i)) continue;
@@ -1093,11 +1233,370 @@ parser_in_progress build_lalr1_parser(grammar_ptr grammar, bool verbose) {
       }
     }
   }
+}
+
+/* DeRemer and Pennello's LALR(1) lookahead computation:
+
+  DeRemer, Frank, and Thomas Pennello.
+  "Efficient computation of LALR(1) look-ahead sets."
+  ACM Transactions on Programming Languages and Systems 4.4 (1982): 615-649.
+
+  Over the nonterminal transitions (p, A) of the LR(0) machine:
+  DR(p, A) are the terminals that can be shifted right after it,
+  (p, A) READS (r, C) if r = GOTO(p, A) and C is nullable, and
+  (p, A) INCLUDES (p', B) if B ::= beta A gamma, gamma is nullable and
+  p' reaches p by spelling beta.
+  Read is DR closed over READS, Follow is Read closed over INCLUDES,
+  and the lookahead set of a reduction by B ::= omega in state q is the
+  union of Follow(p', B) over the transitions it LOOKS BACK to, i.e.
+  those where p' reaches q by spelling omega.
+  The accept production gets a virtual transition on the accept
+  nonterminal out of the start state, whose DR is just EOF. */
+
+namespace {
+
+/* the transitions out of each LR(0) state, sorted by symbol:
+   those of state s are [offsets[s], offsets[s + 1]) */
+struct lr0_gotos {
+  std::vector<int> offsets;
+  std::vector<std::pair<int, int>> edges;
+};
+
+}  // end anonymous namespace
+
+static lr0_gotos get_lr0_gotos(
+    state_in_progress_vector const& states) {
+  lr0_gotos out;
+  reserve(out.offsets, isize(states) + 1);
+  out.offsets.push_back(0);
+  for (auto& state : states) {
+    for (auto& action : state.actions) {
+      if (action.action.kind != action::kind::shift) continue;
+      auto symbol = *(action.context.begin());
+      out.edges.push_back(std::make_pair(symbol, action.action.next_state));
+    }
+    out.offsets.push_back(isize(out.edges));
+  }
+  return out;
+}
+
+/* the index into gotos.edges of the transition, or -1 */
+static int find_goto(lr0_gotos const& gotos, int state, int symbol) {
+  auto first = gotos.edges.begin() + at(gotos.offsets, state);
+  auto last = gotos.edges.begin() + at(gotos.offsets, state + 1);
+  auto it = std::lower_bound(first, last, std::make_pair(symbol, -1));
+  if (it == last || it->first != symbol) return -1;
+  return int(it - gotos.edges.begin());
+}
+
+/* DeRemer and Pennello's "digraph" procedure: makes each F(x) the
+   union of the initial F(y) over all y reachable from x.
+   This is Tarjan's algorithm, without recursion since unit chains
+   can be deep, and all members of a strongly connected component
+   end up sharing one set. */
+static void close_over_digraph(
+    csr_graph const& relation, std::vector<symbol_set>& f) {
+  auto nnodes = get_nnodes(relation);
+  auto const done = nnodes + 1;
+  auto depths = make_vector<int>(nnodes, 0);
+  std::vector<int> stack;
+  struct frame {
+    int node;
+    int depth;
+    int next_edge;
+  };
+  std::vector<frame> frames;
+  auto visit = [&](int x) {
+    stack.push_back(x);
+    at(depths, x) = isize(stack);
+    frames.push_back({x, isize(stack), 0});
+  };
+  auto merge = [&](int x, int y) {
+    at(depths, x) = std::min(at(depths, x), at(depths, y));
+    unite_with(at(f, x), at(f, y));
+  };
+  for (int root = 0; root < nnodes; ++root) {
+    if (at(depths, root) != 0) continue;
+    visit(root);
+    while (!frames.empty()) {
+      auto& top = frames.back();
+      auto x = top.node;
+      auto edges = get_edges(relation, x);
+      if (top.next_edge < edges.size()) {
+        auto y = edges[top.next_edge++];
+        if (at(depths, y) == 0) {
+          visit(y);
+        } else {
+          merge(x, y);
+        }
+        continue;
+      }
+      auto depth = top.depth;
+      frames.pop_back();
+      if (at(depths, x) == depth) {
+        while (true) {
+          auto member = stack.back();
+          stack.pop_back();
+          at(depths, member) = done;
+          if (member == x) break;
+          at(f, member) = at(f, x);
+        }
+      }
+      if (!frames.empty()) merge(frames.back().node, x);
+    }
+  }
+}
+
+namespace {
+
+/* the nonterminal transitions (p, A) of an LR(0) machine, numbered in
+   order of p then A, and last the virtual transition on the accept
+   nonterminal out of the start state */
+struct nonterminal_transitions {
+  lr0_gotos gotos;
+  /* the transition of each edge of gotos, or -1 */
+  std::vector<int> of_edges;
+  /* the edge of gotos of each transition, or -1 for the virtual one */
+  std::vector<int> edges;
+  /* the p of each transition */
+  std::vector<int> sources;
+};
+
+/* the grammar as the walks of DeRemer and Pennello's method see it */
+struct walk_grammar {
+  csr_graph lhs2prods;
+  std::vector<bool> nullable;
+  /* the smallest position from which the rest of each RHS is nullable */
+  std::vector<int> nullable_suffixes;
+};
+
+}  // end anonymous namespace
+
+static nonterminal_transitions get_nonterminal_transitions(
+    state_in_progress_vector const& states, grammar const& grammar) {
+  nonterminal_transitions out;
+  out.gotos = get_lr0_gotos(states);
+  out.of_edges = make_vector<int>(size(out.gotos.edges), -1);
+  for (int s_i = 0; s_i < isize(states); ++s_i) {
+    for (int e = at(out.gotos.offsets, s_i); e < at(out.gotos.offsets, s_i + 1);
+         ++e) {
+      if (!is_nonterminal(grammar, at(out.gotos.edges, e).first)) continue;
+      at(out.of_edges, e) = isize(out.edges);
+      out.edges.push_back(e);
+      out.sources.push_back(s_i);
+    }
+  }
+  out.edges.push_back(-1);
+  out.sources.push_back(0);
+  return out;
+}
+
+static int get_nonterminal(
+    nonterminal_transitions const& ts, int x, grammar const& grammar) {
+  auto e = at(ts.edges, x);
+  if (e == -1) return get_accept_nonterminal(grammar);
+  return at(ts.gotos.edges, e).first;
+}
+
+/* the state GOTO(p, A), or -1 for the virtual transition */
+static int get_target(nonterminal_transitions const& ts, int x) {
+  auto e = at(ts.edges, x);
+  if (e == -1) return -1;
+  return at(ts.gotos.edges, e).second;
+}
+
+static walk_grammar make_walk_grammar(grammar const& grammar) {
+  walk_grammar out;
+  out.nullable = compute_nullable(grammar);
+  edge_list lhs_edges;
+  out.nullable_suffixes = make_vector<int>(size(grammar.productions));
+  for (int prod_i = 0; prod_i < isize(grammar.productions); ++prod_i) {
+    auto& prod = at(grammar.productions, prod_i);
+    lhs_edges.push_back(std::make_pair(prod.lhs, prod_i));
+    auto pos = isize(prod.rhs);
+    while (pos > 0 && at(out.nullable, at(prod.rhs, pos - 1))) --pos;
+    at(out.nullable_suffixes, prod_i) = pos;
+  }
+  out.lhs2prods = make_csr_graph(grammar.nsymbols, lhs_edges);
+  return out;
+}
+
+/* DR(x), and the transitions that x READS appended to (reads) */
+static symbol_set read_directly(nonterminal_transitions const& ts, int x,
+    grammar const& grammar, walk_grammar const& wg, std::vector<int>& reads) {
+  symbol_set dr;
+  auto r = get_target(ts, x);
+  if (r == -1) {
+    dr.insert(get_end_terminal(grammar));
+    return dr;
+  }
+  for (int e = at(ts.gotos.offsets, r); e < at(ts.gotos.offsets, r + 1); ++e) {
+    auto symbol = at(ts.gotos.edges, e).first;
+    if (is_terminal(grammar, symbol)) {
+      dr.insert(symbol);
+    } else if (at(wg.nullable, symbol)) {
+      reads.push_back(at(ts.of_edges, e));
+    }
+  }
+  return dr;
+}
+
+/* walks from transition (y) = (p, B) spelling each production of B,
+   appending to (includes) the transitions that INCLUDE y, and to (ends)
+   the state each production ends in, which is where its reduction
+   LOOKS BACK to y */
+static void walk_productions(nonterminal_transitions const& ts, int y,
+    grammar const& grammar, walk_grammar const& wg, std::vector<int>& includes,
+    std::vector<int>& ends) {
+  auto source = at(ts.sources, y);
+  for (auto prod_i : get_edges(wg.lhs2prods, get_nonterminal(ts, y, grammar))) {
+    auto& rhs = at(grammar.productions, prod_i).rhs;
+    auto state = source;
+    for (int pos = 0; pos < isize(rhs); ++pos) {
+      auto e = find_goto(ts.gotos, state, at(rhs, pos));
+      assert(e != -1);
+      if (at(ts.of_edges, e) != -1 &&
+          pos + 1 >= at(wg.nullable_suffixes, prod_i)) {
+        includes.push_back(at(ts.of_edges, e));
+      }
+      state = at(ts.gotos.edges, e).second;
+    }
+    ends.push_back(state);
+  }
+}
+
+namespace {
+
+/* the relations of the nonterminal transitions, as far as the
+   lookaheads need them */
+struct lalr1_relations {
+  std::vector<context_type> follow_sets;
+  /* the states where the productions of each transition's nonterminal
+     end, in the order of lhs2prods */
+  csr_graph ends;
+};
+
+}  // end anonymous namespace
+
+static lalr1_relations relate_transitions(nonterminal_transitions const& ts,
+    grammar const& grammar, walk_grammar const& wg) {
+  lalr1_relations out;
+  auto ntransitions = isize(ts.edges);
+  /* INCLUDES, from each transition to those that include it, and
+     LOOKBACK, built in CSR form as the walks go */
+  csr_graph included_by;
+  for (auto g : {&included_by, &out.ends}) {
+    reserve(g->offsets, ntransitions + 1);
+    g->offsets.push_back(0);
+  }
+  for (int y = 0; y < ntransitions; ++y) {
+    walk_productions(
+        ts, y, grammar, wg, included_by.edges, out.ends.edges);
+    for (auto g : {&included_by, &out.ends}) {
+      g->offsets.push_back(isize(g->edges));
+    }
+  }
+  /* Read sets: DR closed over READS */
+  out.follow_sets = make_vector<context_type>(ntransitions);
+  edge_list reads;
+  std::vector<int> zs;
+  for (int x = 0; x < ntransitions; ++x) {
+    zs.clear();
+    at(out.follow_sets, x) = read_directly(ts, x, grammar, wg, zs);
+    for (auto z : zs) reads.push_back(std::make_pair(x, z));
+  }
+  close_over_digraph(make_csr_graph(ntransitions, reads), out.follow_sets);
+  /* Follow sets: Read sets closed over INCLUDES */
+  close_over_digraph(make_transpose(included_by), out.follow_sets);
+  return out;
+}
+
+/* gives the reductions in inadequate states their LALR(1) lookahead
+   sets, the union of the Follow sets of the transitions they LOOK BACK
+   to. Reductions in adequate states keep their LR(0) contexts, as
+   they do with lane tracing. */
+static void set_lookaheads(parser_in_progress& pip,
+    nonterminal_transitions const& ts, walk_grammar const& wg,
+    lalr1_relations const& relations, std::vector<bool> const& adequate,
+    bool verbose) {
+  auto& states = pip.states;
+  auto& grammar = pip.grammar;
+  /* reductions come after the shifts of each state */
+  auto for_reductions = [&](int state, auto f) {
+    auto& actions = at(states, state).actions;
+    for (auto it = actions.rbegin();
+         it != actions.rend() && it->action.kind == action::kind::reduce;
+         ++it) {
+      f(*it);
+    }
+  };
+  for (int s_i = 0; s_i < isize(states); ++s_i) {
+    if (at(adequate, s_i)) continue;
+    for_reductions(s_i, [](action_in_progress& action) {
+      action.context = context_type();
+    });
+  }
+  for (int y = 0; y < isize(ts.edges); ++y) {
+    auto prods = get_edges(wg.lhs2prods, get_nonterminal(ts, y, *grammar));
+    auto ends = get_edges(relations.ends, y);
+    assert(prods.size() == ends.size());
+    for (int i = 0; i < ends.size(); ++i) {
+      if (at(adequate, ends[i])) continue;
+      for_reductions(ends[i], [&](action_in_progress& action) {
+        if (action.action.production != prods[i]) return;
+        unite_with(action.context, at(relations.follow_sets, y));
+      });
+    }
+  }
+  if (!verbose) return;
+  for (int s_i = 0; s_i < isize(states); ++s_i) {
+    if (at(adequate, s_i)) continue;
+    for_reductions(s_i, [&](action_in_progress& action) {
+      std::cerr << "LA(" << s_i << ", " << action.action.production << ") = ";
+      print_set(action.context, *grammar);
+      std::cerr << '\n';
+    });
+  }
+}
+
+parser_in_progress build_lalr1_parser(grammar_ptr grammar, bool verbose) {
+  return build_lalr1_parser(grammar, lalr1_method::lane_tracing, verbose);
+}
+
+parser_in_progress build_lalr1_parser(
+    grammar_ptr grammar, lalr1_method method, bool verbose) {
+  parser_in_progress out;
+  auto& cs = out.configs;
+  auto& states = out.states;
+  auto& scs = out.state_configs;
+  auto& states2scs = out.states2state_configs;
+  out.grammar = grammar;
+  cs = make_configs(*grammar);
+  auto lhs2cs = get_left_hand_sides_to_start_configs(cs, *grammar);
+  if (verbose) std::cerr << "Building LR(0) parser\n";
+  states = build_lr0_parser(cs, *grammar, lhs2cs);
+  scs = form_state_configs(states);
+  states2scs = form_states_to_state_configs(scs, states);
+  if (verbose) print_dot("lr0.dot", out);
+  if (verbose) std::cerr << "Checking adequacy of LR(0) machine\n";
+  auto adequate = determine_adequate_states(states, grammar, false, verbose);
+  if (*(std::min_element(adequate.begin(), adequate.end()))) {
+    if (verbose) std::cerr << "The grammar is LR(0)!\n";
+    return out;
+  }
+  if (method == lalr1_method::deremer_pennello) {
+    auto ts = get_nonterminal_transitions(states, *grammar);
+    auto wg = make_walk_grammar(*grammar);
+    auto relations = relate_transitions(ts, *grammar, wg);
+    set_lookaheads(out, ts, wg, relations, adequate, verbose);
+  } else {
+    trace_lanes(out, adequate, verbose);
+  }
   if (verbose) std::cerr << "Checking adequacy of LALR(1) machine\n";
-  adequate = determine_adequate_states(states, grammar, verbose);
+  adequate = determine_adequate_states(states, grammar, true, verbose);
   if (!(*(std::min_element(adequate.begin(), adequate.end())))) {
     std::cerr << "ERROR: The grammar is not LALR(1).\n";
-    determine_adequate_states(states, grammar, true);
+    determine_adequate_states(states, grammar, true, true);
     print_dot("error.dot", out);
     abort();
   }
@@ -1113,8 +1612,19 @@ shift_reduce_tables accept_parser(parser_in_progress const& pip) {
   for (int s_i = 0; s_i < isize(sips); ++s_i) {
     add_state(out);
   }
+  /* ignored terminals are always skipped, even where an LR(0)
+     reduction context would otherwise claim them */
+  auto is_ignored = make_vector<bool>(grammar->nterminals, false);
+  for (auto terminal : grammar->ignored_terminals) {
+    at(is_ignored, terminal) = true;
+  }
+  /* a conflict left in an adequate state is resolved by precedence */
+  parsegen::action none;
+  none.kind = action::kind::none;
+  std::vector<parsegen::action> row;
   for (int s_i = 0; s_i < isize(sips); ++s_i) {
-    auto& sip = *at(sips, s_i);
+    auto& sip = at(sips, s_i);
+    row.assign(std::size_t(grammar->nterminals), none);
     for (auto& action : sip.actions) {
       if (action.action.kind == action::kind::shift &&
           is_nonterminal(*grammar, *(action.context.begin()))) {
@@ -1123,17 +1633,319 @@ shift_reduce_tables accept_parser(parser_in_progress const& pip) {
       } else {
         for (auto terminal : action.context) {
           assert(is_terminal(*grammar, terminal));
-          add_terminal_action(out, s_i, terminal, action.action);
+          if (at(is_ignored, terminal)) continue;
+          auto& cell = at(row, terminal);
+          cell = (cell.kind == action::kind::none)
+                     ? action.action
+                     : resolve_conflict(*grammar, terminal, cell, action.action);
         }
       }
-      for (auto terminal : grammar->ignored_terminals) {
-        assert(is_terminal(*grammar, terminal));
-        parsegen::action action;
-        action.kind = action::kind::skip;
-        add_terminal_action(out, s_i, terminal, action);
+    }
+    for (int terminal = 0; terminal < grammar->nterminals; ++terminal) {
+      if (at(row, terminal).kind == action::kind::none) continue;
+      add_terminal_action(out, s_i, terminal, at(row, terminal));
+    }
+    for (auto terminal : grammar->ignored_terminals) {
+      assert(is_terminal(*grammar, terminal));
+      parsegen::action action;
+      action.kind = action::kind::skip;
+      add_terminal_action(out, s_i, terminal, action);
+    }
+  }
+  return out;
+}
+
+namespace {
+
+/* build_lazy_lr1_tables. An LR(1) state is identified by its kernel,
+   stored as one vector of its configurations in increasing order,
+   each followed by the size of its lookahead set and then the set. */
+class lazy_lr1_rows : public lazy_rows {
+ public:
+  lazy_lr1_rows(grammar_ptr grammar_in);
+  action get_action(int state, int terminal) const override;
+  int get_next_state(int state, int nonterminal) const override;
+  int get_nstates() const override;
+
+ private:
+  struct row {
+    std::vector<packed_action> actions;
+    std::vector<int> next_states;
+  };
+  /* what the productions of a nonterminal in a closure give the
+     lookaheads of a nonterminal they begin with: the FIRST sets of
+     what follows it, and whether they pass on their own lookaheads */
+  struct lookahead_source {
+    int nonterminal;
+    symbol_set first;
+    bool passes_on;
+  };
+  enum { FIRST_CHUNK_SIZE = 64, MAX_CHUNKS = 32 };
+  grammar_ptr grammar;
+  configurations cs;
+  csr_graph lhs2sc;
+  std::vector<first_set_type> follow_first_sets;
+  /* by symbol, for nonterminals */
+  std::vector<std::vector<lookahead_source>> lookahead_sources;
+  std::vector<bool> is_ignored;
+  /* the rows built so far, by state, in chunks of doubling size that
+     never move once allocated, so rows are found without locking */
+  mutable std::array<std::atomic<std::atomic<row const*>*>, MAX_CHUNKS> chunks;
+  mutable std::atomic<int> nbuilt;
+  /* the rest is only used with (mutex) locked */
+  mutable std::mutex mutex;
+  mutable std::vector<std::unique_ptr<std::atomic<row const*>[]>> chunk_storage;
+  mutable std::vector<std::unique_ptr<row const>> rows;
+  mutable kernel_to_state_map kernels2states;
+  /* points to the keys of (kernels2states), which do not move */
+  mutable std::vector<std::vector<int> const*> kernels;
+  /* for each symbol, its node in the closure being built or -1 */
+  mutable std::vector<int> closure_nodes;
+  static void locate(int state, int& chunk, int& offset);
+  row const& get_row(int state) const;
+  row const& build_row(int state) const;
+  int find_or_add_state(std::vector<int>& kernel) const;
+};
+
+lazy_lr1_rows::lazy_lr1_rows(grammar_ptr grammar_in)
+    : grammar(grammar_in), nbuilt(0) {
+  cs = make_configs(*grammar);
+  lhs2sc = get_left_hand_sides_to_start_configs(cs, *grammar);
+  follow_first_sets = compute_follow_first_sets(
+      cs, *grammar, compute_first_sets(*grammar, false));
+  is_ignored = make_vector<bool>(grammar->nterminals, false);
+  for (auto terminal : grammar->ignored_terminals) {
+    at(is_ignored, terminal) = true;
+  }
+  lookahead_sources = make_vector<std::vector<lookahead_source>>(
+      grammar->nsymbols);
+  for (int symbol = grammar->nterminals; symbol < grammar->nsymbols; ++symbol) {
+    auto& sources = at(lookahead_sources, symbol);
+    for (auto sc : get_edges(lhs2sc, symbol)) {
+      auto& prod = at(grammar->productions, at(cs, sc).production);
+      if (prod.rhs.empty() || is_terminal(*grammar, prod.rhs.front())) continue;
+      auto& follow_first = at(follow_first_sets, sc);
+      auto it = std::find_if(sources.begin(), sources.end(),
+          [&](lookahead_source const& source) {
+            return source.nonterminal == prod.rhs.front();
+          });
+      if (it == sources.end()) {
+        sources.push_back({prod.rhs.front(), symbol_set(), false});
+        it = sources.end() - 1;
       }
+      unite_with(it->first, follow_first.terminals);
+      it->passes_on = it->passes_on || follow_first.has_null;
     }
   }
+  for (auto& chunk : chunks) chunk.store(nullptr);
+  closure_nodes = make_vector<int>(grammar->nsymbols, -1);
+  /* the start state has the accept configuration, looking ahead to EOF */
+  auto start_accept_config =
+      get_edges(lhs2sc, get_accept_nonterminal(*grammar)).front();
+  std::vector<int> kernel = {start_accept_config, 1, get_end_terminal(*grammar)};
+  find_or_add_state(kernel);
+}
+
+void lazy_lr1_rows::locate(int state, int& chunk, int& offset) {
+  assert(0 <= state);
+  int start = 0;
+  int chunk_size = FIRST_CHUNK_SIZE;
+  for (chunk = 0; state >= start + chunk_size; ++chunk) {
+    start += chunk_size;
+    chunk_size *= 2;
+  }
+  assert(chunk < MAX_CHUNKS);
+  offset = state - start;
+}
+
+action lazy_lr1_rows::get_action(int state, int terminal) const {
+  return unpack_action(at(get_row(state).actions, terminal));
+}
+
+int lazy_lr1_rows::get_next_state(int state, int nonterminal) const {
+  return at(get_row(state).next_states, nonterminal);
+}
+
+int lazy_lr1_rows::get_nstates() const { return nbuilt.load(); }
+
+lazy_lr1_rows::row const& lazy_lr1_rows::get_row(int state) const {
+  int chunk, offset;
+  locate(state, chunk, offset);
+  auto slots = chunks[std::size_t(chunk)].load(std::memory_order_acquire);
+  if (slots) {
+    auto built = slots[offset].load(std::memory_order_acquire);
+    if (built) return *built;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  return build_row(state);
+}
+
+int lazy_lr1_rows::find_or_add_state(std::vector<int>& kernel) const {
+  auto state = isize(kernels);
+  auto result = kernels2states.emplace(std::move(kernel), state);
+  if (!result.second) return result.first->second;
+  kernels.push_back(&(result.first->first));
+  return state;
+}
+
+/* the LR(1) closure of the kernel of (state), then its actions.
+   All the start configurations of a nonterminal in the closure get
+   the same lookaheads, so those are found per nonterminal: each gets
+   the FIRST sets of what follows it in the items before it, and the
+   lookaheads of those items where that is nullable, which is
+   close_over_digraph over the nonterminals of the closure. */
+lazy_lr1_rows::row const& lazy_lr1_rows::build_row(int state) const {
+  int chunk, offset;
+  locate(state, chunk, offset);
+  auto slots = chunks[std::size_t(chunk)].load(std::memory_order_relaxed);
+  if (!slots) {
+    auto chunk_size = std::size_t(FIRST_CHUNK_SIZE) << chunk;
+    chunk_storage.emplace_back(new std::atomic<row const*>[chunk_size]);
+    slots = chunk_storage.back().get();
+    for (std::size_t i = 0; i < chunk_size; ++i) slots[i].store(nullptr);
+    chunks[std::size_t(chunk)].store(slots, std::memory_order_release);
+  }
+  if (auto built = slots[offset].load(std::memory_order_relaxed)) {
+    return *built;
+  }
+  auto& g = *grammar;
+  /* items are (configuration, lookaheads) */
+  std::vector<std::pair<int, symbol_set const*>> items;
+  std::vector<symbol_set> kernel_lookaheads;
+  auto& kernel = *at(kernels, state);
+  for (int i = 0; i < isize(kernel);) {
+    items.push_back(std::make_pair(at(kernel, i++), nullptr));
+    kernel_lookaheads.emplace_back();
+    auto nlookaheads = at(kernel, i++);
+    for (int j = 0; j < nlookaheads; ++j) {
+      kernel_lookaheads.back().insert(at(kernel, i++));
+    }
+  }
+  std::vector<int> closure;
+  std::vector<symbol_set> closure_lookaheads;
+  edge_list passes;
+  auto add_to_closure = [&](int nonterminal) {
+    auto& node = at(closure_nodes, nonterminal);
+    if (node == -1) {
+      node = isize(closure);
+      closure.push_back(nonterminal);
+      closure_lookaheads.emplace_back();
+    }
+    return node;
+  };
+  for (int i = 0; i < isize(kernel_lookaheads); ++i) {
+    auto config_i = at(items, i).first;
+    at(items, i).second = &at(kernel_lookaheads, i);
+    auto& config = at(cs, config_i);
+    auto& prod = at(g.productions, config.production);
+    if (config.dot == isize(prod.rhs)) continue;
+    auto symbol_after_dot = at(prod.rhs, config.dot);
+    if (is_terminal(g, symbol_after_dot)) continue;
+    auto node = add_to_closure(symbol_after_dot);
+    auto& follow_first = at(follow_first_sets, config_i);
+    unite_with(at(closure_lookaheads, node), follow_first.terminals);
+    if (follow_first.has_null) {
+      unite_with(at(closure_lookaheads, node), at(kernel_lookaheads, i));
+    }
+  }
+  for (int node = 0; node < isize(closure); ++node) {
+    for (auto& source : at(lookahead_sources, at(closure, node))) {
+      auto begun = add_to_closure(source.nonterminal);
+      unite_with(at(closure_lookaheads, begun), source.first);
+      if (source.passes_on) passes.push_back(std::make_pair(begun, node));
+    }
+  }
+  close_over_digraph(make_csr_graph(isize(closure), passes), closure_lookaheads);
+  for (int node = 0; node < isize(closure); ++node) {
+    at(closure_nodes, at(closure, node)) = -1;
+    for (auto sc : get_edges(lhs2sc, at(closure, node))) {
+      items.push_back(std::make_pair(sc, &at(closure_lookaheads, node)));
+    }
+  }
+  std::unique_ptr<row> out(new row());
+  action none;
+  none.kind = action::kind::none;
+  out->actions.assign(std::size_t(g.nterminals), pack_action(none));
+  out->next_states.assign(std::size_t(get_nnonterminals(g)), -1);
+  auto set_action = [&](int terminal, action const& a) {
+    if (at(is_ignored, terminal)) return;
+    auto old = unpack_action(at(out->actions, terminal));
+    if (old.kind == action::kind::none) {
+      at(out->actions, terminal) = pack_action(a);
+      return;
+    }
+    enum action::kind kind;
+    if (old.kind == a.kind ||
+        !resolve_by_precedence(g, terminal,
+            (a.kind == action::kind::reduce) ? a.production : old.production,
+            kind)) {
+      throw std::invalid_argument(
+          "ERROR: The grammar is not LR(1): conflict on terminal " +
+          at(g.symbol_names, terminal) + "\n");
+    }
+    at(out->actions, terminal) =
+        pack_action(resolve_conflict(g, terminal, old, a));
+  };
+  /* (symbol after dot, item), for grouping the items of each successor */
+  std::vector<std::pair<int, int>> transitions;
+  for (int item = 0; item < isize(items); ++item) {
+    auto config_i = at(items, item).first;
+    auto& config = at(cs, config_i);
+    auto& prod = at(g.productions, config.production);
+    if (config.dot == isize(prod.rhs)) {
+      action reduce;
+      reduce.kind = action::kind::reduce;
+      reduce.production = config.production;
+      for (auto terminal : *(at(items, item).second)) {
+        set_action(terminal, reduce);
+      }
+      continue;
+    }
+    transitions.push_back(std::make_pair(at(prod.rhs, config.dot), item));
+  }
+  std::sort(transitions.begin(), transitions.end(),
+      [&](std::pair<int, int> const& a, std::pair<int, int> const& b) {
+        if (a.first != b.first) return a.first < b.first;
+        return at(items, a.second).first < at(items, b.second).first;
+      });
+  std::vector<int> next_kernel;
+  for (int i = 0; i < isize(transitions);) {
+    auto symbol = at(transitions, i).first;
+    next_kernel.clear();
+    for (; i < isize(transitions) && at(transitions, i).first == symbol; ++i) {
+      auto& item = at(items, at(transitions, i).second);
+      /* transition successor should just be the next index */
+      next_kernel.push_back(item.first + 1);
+      next_kernel.push_back(item.second->size());
+      for (auto terminal : *(item.second)) next_kernel.push_back(terminal);
+    }
+    auto next_state = find_or_add_state(next_kernel);
+    if (is_terminal(g, symbol)) {
+      action shift;
+      shift.kind = action::kind::shift;
+      shift.next_state = next_state;
+      set_action(symbol, shift);
+    } else {
+      at(out->next_states, as_nonterminal(g, symbol)) = next_state;
+    }
+  }
+  for (auto terminal : g.ignored_terminals) {
+    action skip;
+    skip.kind = action::kind::skip;
+    at(out->actions, terminal) = pack_action(skip);
+  }
+  rows.emplace_back(std::move(out));
+  auto built = rows.back().get();
+  slots[offset].store(built, std::memory_order_release);
+  ++nbuilt;
+  return *built;
+}
+
+}  // anonymous namespace
+
+shift_reduce_tables build_lazy_lr1_tables(grammar_ptr grammar) {
+  auto out = shift_reduce_tables(grammar, 0);
+  out.lazy = std::make_shared<lazy_lr1_rows>(grammar);
   return out;
 }
 
@@ -5,6 +5,7 @@
 
 #include "parsegen_shift_reduce_tables.hpp"
 #include "parsegen_parser_graph.hpp"
+#include "parsegen_symbol_set.hpp"
 
 namespace parsegen {
 
@@ -15,7 +16,7 @@ struct configuration {
 
 using configurations = std::vector<configuration>;
 
-using context_type = std::set<int>;
+using context_type = symbol_set;
 
 /* nonterminal transitions will be stored as SHIFT
    actions while in progress */
@@ -29,7 +30,7 @@ struct state_in_progress {
   std::vector<action_in_progress> actions;
 };
 
-using state_in_progress_vector = std::vector<std::unique_ptr<state_in_progress>>;
+using state_in_progress_vector = std::vector<state_in_progress>;
 
 struct state_configuration {
   int state;
@@ -42,18 +43,31 @@ struct parser_in_progress {
   state_in_progress_vector states;
   configurations configs;
   state_configurations state_configs;
-  parser_graph states2state_configs;
+  csr_graph states2state_configs;
   grammar_ptr grammar;
 };
 
 state_configurations form_state_configs(state_in_progress_vector const& states);
-parser_graph form_states_to_state_configs(
+csr_graph form_states_to_state_configs(
     state_configurations const& scs, state_in_progress_vector const& states);
 
 void print_dot(std::string const& filepath, parser_in_progress const& pip);
 
 parser_in_progress build_lalr1_parser(grammar_ptr grammar, bool verbose = false);
+parser_in_progress build_lalr1_parser(
+    grammar_ptr grammar, lalr1_method method, bool verbose = false);
 
 shift_reduce_tables accept_parser(parser_in_progress const& pip);
 
+/* tables whose rows are built as a parser enters their states, for
+   grammars so large that most of their states are never used.
+   The states are those of the canonical LR(1) machine, found one
+   kernel at a time, so no global analysis is needed: an input is
+   parsed with the same reductions as with the LALR(1) tables, and an
+   error is found at the same token or earlier. Tables can be shared
+   by parsers on several threads, which share the rows built so far.
+   A conflict is only found when a state having it is built, and is
+   thrown as std::invalid_argument from the parser. */
+shift_reduce_tables build_lazy_lr1_tables(grammar_ptr grammar);
+
 }  // namespace parsegen
@@ -6,11 +6,14 @@
 
 namespace parsegen {
 
-enum { NCHARS = 98 };
+/* symbols [0, NCHARS) are the printable ASCII characters plus
+   tab, newline and carriage return. symbols [NCHARS, NBYTES) are
+   all the other byte values, so an automaton over NCHARS symbols
+   is an ASCII lexer and one over NBYTES symbols is a byte lexer */
+enum { NCHARS = 98, NBYTES = 256 };
 
-#define PARSEGEN_CHARTAB_SIZE 128
-extern int const chartab[PARSEGEN_CHARTAB_SIZE];
-extern char const inv_chartab[NCHARS];
+extern int const chartab[NBYTES];
+extern char const inv_chartab[NBYTES];
 
 }  // end namespace parsegen
 
@@ -1,14 +1,16 @@
 #include "parsegen_finite_automaton.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
-#include <limits>
 #include <map>
-#include <memory>
-#include <queue>
 #include <set>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 
 #include "parsegen_chartab.hpp"
+#include "parsegen_string.hpp"
 
 namespace parsegen {
 
@@ -87,19 +89,21 @@ void append_states(finite_automaton& fa, finite_automaton const& other) {
   auto other_determ = get_determinism(other);
   if (!other_determ) assert(!fa.is_deterministic);
   auto offset = get_nstates(fa);
-  for (int other_state = 0; other_state < get_nstates(other); ++other_state) {
-    auto my_state = add_state(fa);
-    auto token = accepts(other, other_state);
-    if (0 <= token) add_accept(fa, my_state, token);
-  }
+  auto nstates = offset + get_nstates(other);
+  auto ncols = get_nsymbols_eps(fa);
+  auto other_ncols = get_nsymbols_eps(other);
+  /* grow once, then copy rows with shifted targets */
+  resize(fa.table, nstates, ncols);
+  resize(fa.accepted_tokens, nstates);
   for (int other_state = 0; other_state < get_nstates(other); ++other_state) {
     auto my_state = other_state + offset;
-    for (int symbol = 0; symbol < get_nsymbols_eps(other); ++symbol) {
-      auto other_next = step(other, other_state, symbol);
-      if (other_next < 0) continue;
-      auto my_next = other_next + offset;
-      add_transition(fa, my_state, symbol, my_next);
+    for (int symbol = 0; symbol < ncols; ++symbol) {
+      auto other_next =
+          (symbol < other_ncols) ? step(other, other_state, symbol) : -1;
+      at(fa.table, my_state, symbol) =
+          (other_next < 0) ? -1 : (other_next + offset);
     }
+    at(fa.accepted_tokens, my_state) = accepts(other, other_state);
   }
 }
 
@@ -127,6 +131,82 @@ finite_automaton add_death_state(finite_automaton const& a) {
   return out;
 }
 
+sparse_nfa::sparse_nfa(int nsymbols_init, int nstates_reserve)
+    : nsymbols(nsymbols_init) {
+  reserve(accepted_tokens, nstates_reserve);
+  reserve(edges, nstates_reserve);
+}
+
+int get_nstates(sparse_nfa const& nfa) { return isize(nfa.accepted_tokens); }
+
+int get_nsymbols(sparse_nfa const& nfa) { return nfa.nsymbols; }
+
+int get_epsilon(sparse_nfa const& nfa) { return nfa.nsymbols; }
+
+int add_state(sparse_nfa& nfa) {
+  auto state = get_nstates(nfa);
+  nfa.accepted_tokens.push_back(-1);
+  return state;
+}
+
+void add_transition(
+    sparse_nfa& nfa, int from_state, int at_symbol, int to_state) {
+  assert(0 <= from_state);
+  assert(from_state < get_nstates(nfa));
+  assert(0 <= to_state);
+  assert(to_state < get_nstates(nfa));
+  assert(0 <= at_symbol);
+  assert(at_symbol <= get_epsilon(nfa));
+  nfa.edges.push_back({from_state, at_symbol, to_state});
+}
+
+void add_accept(sparse_nfa& nfa, int state, int token) {
+  assert(0 <= token);
+  at(nfa.accepted_tokens, state) = token;
+}
+
+int accepts(sparse_nfa const& nfa, int state) {
+  return at(nfa.accepted_tokens, state);
+}
+
+/* both epsilon columns of a dense automaton become epsilon edges */
+void append_states(sparse_nfa& nfa, finite_automaton const& other) {
+  assert(get_nsymbols(other) == get_nsymbols(nfa));
+  auto offset = get_nstates(nfa);
+  auto ncols = get_nsymbols_eps(other);
+  auto epsilon = get_epsilon(nfa);
+  for (int other_state = 0; other_state < get_nstates(other); ++other_state) {
+    at(nfa.accepted_tokens, add_state(nfa)) = accepts(other, other_state);
+  }
+  for (int other_state = 0; other_state < get_nstates(other); ++other_state) {
+    for (int symbol = 0; symbol < ncols; ++symbol) {
+      auto other_next = step(other, other_state, symbol);
+      if (other_next == -1) continue;
+      add_transition(nfa, other_state + offset,
+          (symbol < get_nsymbols(other)) ? symbol : epsilon,
+          other_next + offset);
+    }
+  }
+}
+
+void append_states(sparse_nfa& nfa, sparse_nfa const& other) {
+  assert(get_nsymbols(other) == get_nsymbols(nfa));
+  auto offset = get_nstates(nfa);
+  nfa.accepted_tokens.insert(nfa.accepted_tokens.end(),
+      other.accepted_tokens.begin(), other.accepted_tokens.end());
+  reserve(nfa.edges, isize(nfa.edges) + isize(other.edges));
+  for (auto& edge : other.edges) {
+    nfa.edges.push_back(
+        {edge.from_state + offset, edge.symbol, edge.to_state + offset});
+  }
+}
+
+sparse_nfa make_sparse(finite_automaton const& fa) {
+  sparse_nfa out(get_nsymbols(fa), get_nstates(fa));
+  append_states(out, fa);
+  return out;
+}
+
 finite_automaton finite_automaton::make_single_nfa(
     int nsymbols, int symbol, int token) {
   return finite_automaton::make_range_nfa(nsymbols, symbol, symbol, token);
@@ -175,6 +255,49 @@ finite_automaton finite_automaton::unite(
   return out;
 }
 
+/* union of two DFAs by the product construction, giving a DFA
+   directly: each state is a pair of states of (a) and (b), either of
+   which may be the dead state. A pair accepting a token in both keeps
+   the lower one, the same priority make_deterministic uses. */
+finite_automaton finite_automaton::unite_deterministic(
+    finite_automaton const& a, finite_automaton const& b) {
+  assert(get_determinism(a));
+  assert(get_determinism(b));
+  assert(get_nsymbols(a) == get_nsymbols(b));
+  auto nsymbols = get_nsymbols(a);
+  /* pair (i, j) has index (i + 1) * (nb + 1) + (j + 1), so that
+     the dead state -1 has index 0 */
+  auto nb = get_nstates(b);
+  auto pair_states = make_vector<int>((get_nstates(a) + 1) * (nb + 1), -1);
+  std::vector<std::pair<int, int>> pairs;
+  finite_automaton out(nsymbols, true, 0);
+  auto get_state = [&](int i, int j) {
+    auto& state = at(pair_states, (i + 1) * (nb + 1) + (j + 1));
+    if (state == -1) {
+      state = add_state(out);
+      pairs.push_back(std::make_pair(i, j));
+      auto token_a = (i == -1) ? -1 : accepts(a, i);
+      auto token_b = (j == -1) ? -1 : accepts(b, j);
+      auto token = token_a;
+      if (token == -1 || (token_b != -1 && token_b < token)) token = token_b;
+      if (token != -1) add_accept(out, state, token);
+    }
+    return state;
+  };
+  get_state(0, 0);
+  for (int state = 0; state < get_nstates(out); ++state) {
+    for (int symbol = 0; symbol < nsymbols; ++symbol) {
+      auto i = at(pairs, state).first;
+      auto j = at(pairs, state).second;
+      auto next_i = (i == -1) ? -1 : step(a, i, symbol);
+      auto next_j = (j == -1) ? -1 : step(b, j, symbol);
+      if (next_i == -1 && next_j == -1) continue;
+      add_transition(out, state, symbol, get_state(next_i, next_j));
+    }
+  }
+  return out;
+}
+
 finite_automaton finite_automaton::concat(
     finite_automaton const& a, finite_automaton const& b, int token) {
   auto nsymbols = get_nsymbols(a);
@@ -257,113 +380,454 @@ finite_automaton finite_automaton::make_rolling(finite_automaton const& a) {
 
 finite_automaton remove_transitions_from_accepting(finite_automaton const& a) {
   assert(get_determinism(a));
-  finite_automaton out(get_nsymbols(a), false, get_nstates(a));
-  append_states(out, a);
+  finite_automaton out = a;
   for (int i = 0; i < get_nstates(a); ++i) {
     if (accepts(out, i) == -1) continue;
     for (int s = 0; s < get_nsymbols(a); ++s) {
-      if (step(out, i, s) != -1) {
-        add_transition(out, i, s, -1);
-      }
+      at(out.table, i, s) = -1;
     }
   }
   return out;
 }
 
-using state_set = std::set<int>;
-
-static state_set step(
-    state_set const& ss, int symbol, finite_automaton const& fa) {
-  state_set next_ss;
-  for (auto state : ss) {
-    auto next_state = step(fa, state, symbol);
-    if (next_state != -1) next_ss.insert(next_state);
+void count_state_visits(finite_automaton const& fa, std::string const& text,
+    std::vector<long>& visits) {
+  assert(get_determinism(fa));
+  if (isize(visits) < get_nstates(fa)) resize(visits, get_nstates(fa));
+  int const n = isize(text);
+  int start = 0;
+  while (start < n) {
+    int state = 0;
+    ++at(visits, state);
+    int last_accept = -1;
+    for (int i = start; i < n; ++i) {
+      auto c = at(text, i);
+      if (!is_symbol(c, get_nsymbols(fa))) break;
+      state = step(fa, state, get_symbol(c));
+      if (state == -1) break;
+      ++at(visits, state);
+      if (accepts(fa, state) != -1) last_accept = i + 1;
+    }
+    /* on a tokenization failure, skip a character and keep going
+       so the rest of the text still contributes to the profile */
+    start = (last_accept == -1) ? (start + 1) : last_accept;
   }
-  return next_ss;
 }
 
-using state_queue = std::queue<int>;
-
-static state_set get_epsilon_closure(state_set ss, finite_automaton const& fa) {
-  state_queue q;
-  for (auto state : ss) q.push(state);
-  auto epsilon0 = get_epsilon0(fa);
-  auto epsilon1 = get_epsilon1(fa);
-  while (!q.empty()) {
-    auto state = q.front();
-    q.pop();
-    for (auto epsilon = epsilon0; epsilon <= epsilon1; ++epsilon) {
-      auto next_state = step(fa, state, epsilon);
-      if (next_state == -1) continue;
-      if (!ss.count(next_state)) {
-        ss.insert(next_state);
-        q.push(next_state);
+std::vector<int> get_hot_state_order(
+    finite_automaton const& fa, std::vector<long> const& visits) {
+  auto nstates = get_nstates(fa);
+  auto count = [&](int state) {
+    return state < isize(visits) ? at(visits, state) : 0L;
+  };
+  std::vector<int> by_heat;
+  reserve(by_heat, nstates);
+  for (int state = 1; state < nstates; ++state) by_heat.push_back(state);
+  std::stable_sort(by_heat.begin(), by_heat.end(),
+      [&](int a, int b) { return count(a) > count(b); });
+  auto placed = make_vector<bool>(nstates, false);
+  std::vector<int> order;
+  reserve(order, nstates);
+  /* the start state stays at 0 by convention */
+  auto place_chain = [&](int state) {
+    while (state != -1) {
+      at(placed, state) = true;
+      order.push_back(state);
+      int best = -1;
+      for (int symbol = 0; symbol < get_nsymbols(fa); ++symbol) {
+        auto next = step(fa, state, symbol);
+        if (next == -1 || at(placed, next)) continue;
+        if (best == -1 || count(next) > count(best)) best = next;
       }
+      /* don't drag cold states into the hot region */
+      if (best != -1 && count(best) == 0 && count(state) != 0) best = -1;
+      state = best;
     }
+  };
+  place_chain(0);
+  for (auto state : by_heat) {
+    if (!at(placed, state)) place_chain(state);
+  }
+  return order;
+}
+
+finite_automaton reorder_states(
+    finite_automaton const& fa, std::vector<int> const& order) {
+  auto nstates = get_nstates(fa);
+  assert(isize(order) == nstates);
+  assert(nstates == 0 || at(order, 0) == 0);
+  auto new_from_old = make_vector<int>(nstates, -1);
+  for (int new_state = 0; new_state < nstates; ++new_state) {
+    at(new_from_old, at(order, new_state)) = new_state;
+  }
+  finite_automaton out(get_nsymbols(fa), get_determinism(fa), nstates);
+  for (int new_state = 0; new_state < nstates; ++new_state) {
+    add_state(out);
   }
-  return ss;
+  for (int new_state = 0; new_state < nstates; ++new_state) {
+    auto old_state = at(order, new_state);
+    for (int symbol = 0; symbol < get_nsymbols_eps(fa); ++symbol) {
+      auto old_next = step(fa, old_state, symbol);
+      if (old_next == -1) continue;
+      add_transition(out, new_state, symbol, at(new_from_old, old_next));
+    }
+    auto token = accepts(fa, old_state);
+    if (token != -1) add_accept(out, new_state, token);
+  }
+  return out;
+}
+
+finite_automaton reorder_by_profile(
+    finite_automaton const& fa, std::vector<std::string> const& corpus) {
+  std::vector<long> visits;
+  for (auto& text : corpus) count_state_visits(fa, text, visits);
+  return reorder_states(fa, get_hot_state_order(fa, visits));
 }
 
-using state_set_ptr = state_set*;
+/* NFA state sets are kept as sorted vectors */
+using state_set = std::vector<int>;
 
-struct state_set_ptr_compare {
-  bool operator()(state_set_ptr const& a, state_set_ptr const& b) const {
-    return *a < *b;
+struct state_set_hash {
+  std::size_t operator()(state_set const& ss) const {
+    std::size_t h = ss.size();
+    for (auto state : ss) {
+      h ^= std::hash<int>()(state) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    }
+    return h;
   }
 };
 
-using state_set_ptr_to_state_map = std::map<state_set_ptr, int, state_set_ptr_compare>;
-using state_set_ptr_vector = std::vector<std::unique_ptr<state_set>>;
+using state_set_to_state_map =
+    std::unordered_map<state_set, int, state_set_hash>;
+
+namespace {
+
+/* the per-NFA-state data that the powerset construction keeps
+   coming back to: the edges leaving each state, grouped by state
+   (edges of state i are [offsets[i], offsets[i + 1])) with the
+   epsilon edges separate, and the epsilon closure of each state */
+struct subset_construction_helper {
+  sparse_nfa const& nfa;
+  std::vector<int> offsets;
+  std::vector<std::pair<int, int>> edges;
+  std::vector<int> epsilon_offsets;
+  std::vector<int> epsilon_targets;
+  std::vector<state_set> closures;
+  subset_construction_helper(sparse_nfa const& nfa_in, int nthreads);
+  void compute(int state, std::vector<int>& closure_stamps);
+};
+
+/* the successors of one DFA state, computed before it is numbered */
+struct state_set_expansion {
+  std::vector<int> symbols;
+  std::vector<state_set> next_sets;
+  int token;
+};
+
+}  // end anonymous namespace
+
+/* calls f(i, thread) for i in [0, n), spread over up to nthreads threads */
+template <typename F>
+static void parallel_for(int n, int nthreads, F const& f) {
+  if (nthreads > n) nthreads = n;
+  if (nthreads <= 1) {
+    for (int i = 0; i < n; ++i) f(i, 0);
+    return;
+  }
+  std::atomic<int> next(0);
+  auto work = [&](int thread) {
+    for (int i = next++; i < n; i = next++) f(i, thread);
+  };
+  std::vector<std::thread> threads;
+  for (int thread = 1; thread < nthreads; ++thread) {
+    threads.emplace_back(work, thread);
+  }
+  work(0);
+  for (auto& thread : threads) thread.join();
+}
+
+subset_construction_helper::subset_construction_helper(
+    sparse_nfa const& nfa_in, int nthreads)
+    : nfa(nfa_in),
+      offsets(std::size_t(get_nstates(nfa_in) + 1), 0),
+      epsilon_offsets(std::size_t(get_nstates(nfa_in) + 1), 0),
+      closures(std::size_t(get_nstates(nfa_in))) {
+  auto nstates = get_nstates(nfa);
+  auto epsilon = get_epsilon(nfa);
+  /* counting sort of the edges by source state */
+  for (auto& edge : nfa.edges) {
+    if (edge.symbol == epsilon) {
+      ++at(epsilon_offsets, edge.from_state + 1);
+    } else {
+      ++at(offsets, edge.from_state + 1);
+    }
+  }
+  for (int state = 0; state < nstates; ++state) {
+    at(offsets, state + 1) += at(offsets, state);
+    at(epsilon_offsets, state + 1) += at(epsilon_offsets, state);
+  }
+  resize(edges, at(offsets, nstates));
+  resize(epsilon_targets, at(epsilon_offsets, nstates));
+  auto fill = offsets;
+  auto epsilon_fill = epsilon_offsets;
+  for (auto& edge : nfa.edges) {
+    if (edge.symbol == epsilon) {
+      at(epsilon_targets, at(epsilon_fill, edge.from_state)++) = edge.to_state;
+    } else {
+      at(edges, at(fill, edge.from_state)++) =
+          std::make_pair(edge.symbol, edge.to_state);
+    }
+  }
+  if (nthreads > nstates) nthreads = nstates;
+  if (nthreads < 1) nthreads = 1;
+  auto stamps = make_vector<std::vector<int>>(nthreads);
+  for (auto& thread_stamps : stamps) {
+    thread_stamps = make_vector<int>(nstates, -1);
+  }
+  parallel_for(nstates, nthreads,
+      [&](int state, int thread) { compute(state, at(stamps, thread)); });
+}
+
+void subset_construction_helper::compute(
+    int state, std::vector<int>& closure_stamps) {
+  auto& closure = at(closures, state);
+  std::vector<int> stack;
+  stack.push_back(state);
+  closure.push_back(state);
+  at(closure_stamps, state) = state;
+  while (!stack.empty()) {
+    auto from = stack.back();
+    stack.pop_back();
+    for (auto i = at(epsilon_offsets, from);
+         i < at(epsilon_offsets, from + 1); ++i) {
+      auto next_state = at(epsilon_targets, i);
+      if (at(closure_stamps, next_state) == state) continue;
+      at(closure_stamps, next_state) = state;
+      closure.push_back(next_state);
+      stack.push_back(next_state);
+    }
+  }
+  std::sort(closure.begin(), closure.end());
+}
 
-static void emplace_back(state_set_ptr_vector& ssupv, state_set& ss) {
-  ssupv.push_back(std::unique_ptr<state_set>(new state_set(std::move(ss))));
+static void sort_unique(state_set& ss) {
+  std::sort(ss.begin(), ss.end());
+  ss.erase(std::unique(ss.begin(), ss.end()), ss.end());
+}
+
+static int get_accepted_token(
+    subset_construction_helper const& helper, state_set const& ss) {
+  int token = -1;
+  for (auto nfa_state : ss) {
+    auto nfa_token = accepts(helper.nfa, nfa_state);
+    if (nfa_token == -1) continue;
+    if (token == -1 || nfa_token < token) token = nfa_token;
+  }
+  return token;
+}
+
+/* (buckets) is scratch space with one empty state set per symbol */
+static void expand(subset_construction_helper const& helper,
+    state_set const& ss, std::vector<state_set>& buckets,
+    state_set_expansion& expansion) {
+  expansion.symbols.clear();
+  expansion.next_sets.clear();
+  for (auto nfa_state : ss) {
+    for (auto i = at(helper.offsets, nfa_state);
+         i < at(helper.offsets, nfa_state + 1); ++i) {
+      auto& edge = at(helper.edges, i);
+      auto& next_ss = at(buckets, edge.first);
+      if (next_ss.empty()) expansion.symbols.push_back(edge.first);
+      auto& closure = at(helper.closures, edge.second);
+      next_ss.insert(next_ss.end(), closure.begin(), closure.end());
+    }
+  }
+  /* visit symbols in order so numbering matches a dense sweep */
+  std::sort(expansion.symbols.begin(), expansion.symbols.end());
+  for (auto symbol : expansion.symbols) {
+    auto& next_ss = at(buckets, symbol);
+    sort_unique(next_ss);
+    expansion.next_sets.push_back(std::move(next_ss));
+    next_ss.clear();
+  }
+  expansion.token = get_accepted_token(helper, ss);
 }
 
-/* powerset construction, NFA -> DFA */
 finite_automaton finite_automaton::make_deterministic(
     finite_automaton const& nfa) {
+  return make_deterministic(nfa, 1);
+}
+
+finite_automaton finite_automaton::make_deterministic(
+    finite_automaton const& nfa, int nthreads) {
   if (get_determinism(nfa)) return nfa;
-  state_set_ptr_to_state_map ssp2s;
-  state_set_ptr_vector ssupv;
+  return make_deterministic(make_sparse(nfa), nthreads);
+}
+
+finite_automaton finite_automaton::make_deterministic(sparse_nfa const& nfa) {
+  return make_deterministic(nfa, 1);
+}
+
+/* powerset construction, NFA -> DFA.
+   DFA states are expanded a batch at a time: with one thread each
+   batch is a single state, otherwise it is the whole breadth-first
+   frontier and the states in it are expanded concurrently.
+   Numbering the new states is done serially, in the same order as the
+   single-threaded sweep, so the tables are identical either way. */
+finite_automaton finite_automaton::make_deterministic(
+    sparse_nfa const& nfa, int nthreads) {
+  if (nthreads < 1) nthreads = 1;
+  subset_construction_helper helper(nfa, nthreads);
+  state_set_to_state_map ss2s;
+  std::vector<state_set> sets;
   finite_automaton out(get_nsymbols(nfa), true, 0);
-  state_set start_ss;
-  start_ss.insert(0);
-  start_ss = get_epsilon_closure(start_ss, nfa);
-  emplace_back(ssupv, start_ss);
-  ssp2s[ssupv.back().get()] = add_state(out);
-  int front = 0;
-  while (front < int(ssupv.size())) {
-    auto state = front;
-    auto& ss = *at(ssupv, front);
-    ++front;
-    for (int symbol = 0; symbol < get_nsymbols(nfa); ++symbol) {
-      auto unclosed_next_ss = parsegen::step(ss, symbol, nfa);
-      if (unclosed_next_ss.empty()) continue;
-      auto next_ss = get_epsilon_closure(unclosed_next_ss, nfa);
-      int next_state;
-      auto it = ssp2s.find(&next_ss);
-      if (it == ssp2s.end()) {
-        next_state = add_state(out);
-        emplace_back(ssupv, next_ss);
-        ssp2s[ssupv.back().get()] = next_state;
-      } else {
-        next_state = it->second;
-      }
-      add_transition(out, state, symbol, next_state);
-    }
-    int min_accepted = -1;
-    for (auto nfa_state : ss) {
-      auto nfa_token = accepts(nfa, nfa_state);
-      if (nfa_token == -1) continue;
-      if (min_accepted == -1 || nfa_token < min_accepted) {
-        min_accepted = nfa_token;
+  sets.push_back(at(helper.closures, 0));
+  ss2s.emplace(sets.back(), add_state(out));
+  auto buckets = make_vector<std::vector<state_set>>(nthreads);
+  for (auto& thread_buckets : buckets) {
+    thread_buckets = make_vector<state_set>(get_nsymbols(nfa));
+  }
+  std::vector<state_set_expansion> expansions;
+  enum { MAX_BATCH = 4096 };
+  for (int front = 0; front < isize(sets);) {
+    auto batch = (nthreads == 1) ? 1 : isize(sets) - front;
+    if (batch > MAX_BATCH) batch = MAX_BATCH;
+    if (isize(expansions) < batch) resize(expansions, batch);
+    parallel_for(batch, nthreads, [&](int i, int thread) {
+      expand(helper, at(sets, front + i), at(buckets, thread),
+          at(expansions, i));
+    });
+    for (int i = 0; i < batch; ++i) {
+      auto state = front + i;
+      auto& expansion = at(expansions, i);
+      for (int j = 0; j < isize(expansion.symbols); ++j) {
+        auto& next_ss = at(expansion.next_sets, j);
+        int next_state;
+        auto it = ss2s.find(next_ss);
+        if (it == ss2s.end()) {
+          next_state = add_state(out);
+          ss2s.emplace(next_ss, next_state);
+          sets.push_back(std::move(next_ss));
+        } else {
+          next_state = it->second;
+        }
+        add_transition(out, state, at(expansion.symbols, j), next_state);
       }
+      if (expansion.token != -1) add_accept(out, state, expansion.token);
     }
-    if (min_accepted != -1) add_accept(out, state, min_accepted);
+    front += batch;
   }
   return out;
 }
 
+/* a row of the transition cache is filled in all at once, the first
+   time any transition out of that state is asked for */
+enum { UNKNOWN_STATE = -2 };
+
+struct lazy_dfa::cache {
+  sparse_nfa nfa;
+  subset_construction_helper helper;
+  int max_states;
+  std::vector<state_set> sets;
+  std::vector<int> tokens;
+  parsegen::table<int> transitions;
+  state_set_to_state_map ss2s;
+  std::vector<state_set> buckets;
+  state_set_expansion expansion;
+  std::vector<int> next_states;
+  int nflushes;
+  cache(sparse_nfa const& nfa_in, int max_states_in);
+  int add_state(state_set const& ss);
+  void flush();
+};
+
+lazy_dfa::cache::cache(sparse_nfa const& nfa_in, int max_states_in)
+    : nfa(nfa_in),
+      helper(nfa, 1),
+      max_states(max_states_in),
+      transitions(parsegen::get_nsymbols(nfa_in), 0),
+      buckets(std::size_t(parsegen::get_nsymbols(nfa_in))),
+      nflushes(0) {}
+
+int lazy_dfa::cache::add_state(state_set const& ss) {
+  auto state = isize(sets);
+  sets.push_back(ss);
+  tokens.push_back(get_accepted_token(helper, ss));
+  resize(transitions, state + 1, get_ncols(transitions));
+  for (int symbol = 0; symbol < get_ncols(transitions); ++symbol) {
+    at(transitions, state, symbol) = UNKNOWN_STATE;
+  }
+  ss2s.emplace(ss, state);
+  return state;
+}
+
+void lazy_dfa::cache::flush() {
+  sets.clear();
+  tokens.clear();
+  resize(transitions, 0, get_ncols(transitions));
+  ss2s.clear();
+  ++nflushes;
+}
+
+lazy_dfa::lazy_dfa(sparse_nfa const& nfa, int max_cached_states)
+    : data(new cache(nfa, max_cached_states)) {}
+
+lazy_dfa::~lazy_dfa() = default;
+
+int lazy_dfa::get_start_state() {
+  auto& start_set = at(data->helper.closures, 0);
+  auto it = data->ss2s.find(start_set);
+  if (it != data->ss2s.end()) return it->second;
+  return data->add_state(start_set);
+}
+
+int lazy_dfa::step(int state, int symbol) {
+  assert(0 <= symbol);
+  assert(symbol < get_nsymbols());
+  auto next_state = at(data->transitions, state, symbol);
+  if (next_state != UNKNOWN_STATE) return next_state;
+  auto& expansion = data->expansion;
+  expand(data->helper, at(data->sets, state), data->buckets, expansion);
+  auto& next_states = data->next_states;
+  next_states.clear();
+  int nnew = 0;
+  for (auto& next_ss : expansion.next_sets) {
+    auto it = data->ss2s.find(next_ss);
+    next_states.push_back((it == data->ss2s.end()) ? -1 : it->second);
+    if (it == data->ss2s.end()) ++nnew;
+  }
+  if (nnew > 0 && isize(data->sets) + nnew > data->max_states) {
+    auto current_set = at(data->sets, state);
+    data->flush();
+    state = data->add_state(current_set);
+    for (auto& next : next_states) next = -1;
+  }
+  for (int j = 0; j < isize(expansion.symbols); ++j) {
+    auto& next_ss = at(expansion.next_sets, j);
+    auto& next = at(next_states, j);
+    if (next == -1) {
+      auto it = data->ss2s.find(next_ss);
+      next = (it == data->ss2s.end()) ? data->add_state(next_ss) : it->second;
+    }
+  }
+  for (int s = 0; s < get_nsymbols(); ++s) {
+    at(data->transitions, state, s) = -1;
+  }
+  for (int j = 0; j < isize(expansion.symbols); ++j) {
+    at(data->transitions, state, at(expansion.symbols, j)) =
+        at(next_states, j);
+  }
+  return at(data->transitions, state, symbol);
+}
+
+int lazy_dfa::accepts(int state) const { return at(data->tokens, state); }
+
+int lazy_dfa::get_nsymbols() const { return get_ncols(data->transitions); }
+
+int lazy_dfa::get_ncached_states() const { return isize(data->sets); }
+
+int lazy_dfa::get_nflushes() const { return data->nflushes; }
+
 struct state_row_compare {
   parsegen::table<int> const& table;
   std::vector<int> const& accepted;
@@ -416,7 +880,217 @@ finite_automaton finite_automaton::simplify_once(finite_automaton const& fa) {
   return out;
 }
 
+/* DFA minimization by partition refinement, based on:
+
+   Hopcroft, John.
+   "An n log n algorithm for minimizing states in a finite automaton."
+   Theory of machines and computations. Academic Press, 1971. 189-196.
+
+   Each splitter block is used with all symbols at once, so it is enough
+   to queue only the smaller half of a block that was split while not
+   queued. Missing transitions go to an implicit dead state, and any
+   states found equivalent to it, as well as unreachable states,
+   are removed from the output. */
+namespace {
+
+struct partition {
+  std::vector<int> elements;
+  std::vector<int> location;
+  std::vector<int> block_of;
+  std::vector<int> first;
+  std::vector<int> past;
+  std::vector<int> marked;
+  partition(std::vector<int> const& initial_block_of, int nblocks)
+      : location(initial_block_of.size()),
+        block_of(initial_block_of),
+        first(std::size_t(nblocks), 0),
+        past(std::size_t(nblocks), 0),
+        marked(std::size_t(nblocks), 0) {
+    auto sizes = make_vector<int>(nblocks, 0);
+    for (auto b : block_of) ++at(sizes, b);
+    int offset = 0;
+    for (int b = 0; b < nblocks; ++b) {
+      at(first, b) = at(past, b) = offset;
+      offset += at(sizes, b);
+    }
+    resize(elements, isize(block_of));
+    for (int e = 0; e < isize(block_of); ++e) {
+      auto b = at(block_of, e);
+      at(location, e) = at(past, b);
+      at(elements, at(past, b)++) = e;
+    }
+  }
+  int get_nblocks() const { return isize(first); }
+  int get_size(int b) const { return at(past, b) - at(first, b); }
+  /* move e to the front (marked) part of its block */
+  void mark(int e) {
+    auto b = at(block_of, e);
+    auto i = at(location, e);
+    auto j = at(first, b) + at(marked, b);
+    if (i < j) return;
+    auto other = at(elements, j);
+    at(elements, j) = e;
+    at(location, e) = j;
+    at(elements, i) = other;
+    at(location, other) = i;
+    ++at(marked, b);
+  }
+  /* split the marked part off into a new block, returns -1 if
+     the whole block was marked */
+  int split(int b) {
+    auto nmarked = at(marked, b);
+    at(marked, b) = 0;
+    if (nmarked == get_size(b)) return -1;
+    auto nb = get_nblocks();
+    first.push_back(at(first, b));
+    past.push_back(at(first, b) + nmarked);
+    marked.push_back(0);
+    at(first, b) += nmarked;
+    for (int i = at(first, nb); i < at(past, nb); ++i) {
+      at(block_of, at(elements, i)) = nb;
+    }
+    return nb;
+  }
+};
+
+}  // end anonymous namespace
+
+static finite_automaton minimize(finite_automaton const& fa) {
+  assert(get_determinism(fa));
+  auto nstates = get_nstates(fa);
+  auto nsymbols = get_nsymbols(fa);
+  auto dead = nstates;
+  auto nelements = nstates + 1;
+  /* initial partition: by accepted token, the dead state rejects */
+  std::map<int, int> token_blocks;
+  token_blocks[-1] = 0;
+  auto initial = make_vector<int>(nelements, 0);
+  for (int state = 0; state < nstates; ++state) {
+    auto token = accepts(fa, state);
+    auto res = token_blocks.insert(
+        std::make_pair(token, int(token_blocks.size())));
+    at(initial, state) = res.first->second;
+  }
+  partition p(initial, int(token_blocks.size()));
+  /* inverse transitions, compressed by (symbol, target) */
+  auto inverse_offsets = make_vector<int>(nsymbols * nelements + 1, 0);
+  for (int state = 0; state < nstates; ++state) {
+    for (int symbol = 0; symbol < nsymbols; ++symbol) {
+      auto next = step(fa, state, symbol);
+      if (next == -1) next = dead;
+      ++at(inverse_offsets, symbol * nelements + next + 1);
+    }
+  }
+  for (int symbol = 0; symbol < nsymbols; ++symbol) {
+    /* the dead state goes to itself */
+    ++at(inverse_offsets, symbol * nelements + dead + 1);
+  }
+  for (int i = 1; i < isize(inverse_offsets); ++i) {
+    at(inverse_offsets, i) += at(inverse_offsets, i - 1);
+  }
+  auto fill = inverse_offsets;
+  auto inverse = make_vector<int>(inverse_offsets.back());
+  for (int state = 0; state < nelements; ++state) {
+    for (int symbol = 0; symbol < nsymbols; ++symbol) {
+      auto next = (state == dead) ? dead : step(fa, state, symbol);
+      if (next == -1) next = dead;
+      at(inverse, at(fill, symbol * nelements + next)++) = state;
+    }
+  }
+  std::vector<int> worklist;
+  auto in_worklist = make_vector<bool>(p.get_nblocks(), false);
+  {
+    int largest = 0;
+    for (int b = 1; b < p.get_nblocks(); ++b) {
+      if (p.get_size(b) > p.get_size(largest)) largest = b;
+    }
+    for (int b = 0; b < p.get_nblocks(); ++b) {
+      if (b == largest) continue;
+      worklist.push_back(b);
+      at(in_worklist, b) = true;
+    }
+  }
+  std::vector<int> splitter;
+  std::vector<int> touched;
+  while (!worklist.empty()) {
+    auto a = worklist.back();
+    worklist.pop_back();
+    at(in_worklist, a) = false;
+    splitter.assign(p.elements.begin() + at(p.first, a),
+        p.elements.begin() + at(p.past, a));
+    for (int symbol = 0; symbol < nsymbols; ++symbol) {
+      touched.clear();
+      for (auto target : splitter) {
+        auto begin = at(inverse_offsets, symbol * nelements + target);
+        auto end = at(inverse_offsets, symbol * nelements + target + 1);
+        for (auto i = begin; i < end; ++i) {
+          auto source = at(inverse, i);
+          auto b = at(p.block_of, source);
+          if (at(p.marked, b) == 0) touched.push_back(b);
+          p.mark(source);
+        }
+      }
+      for (auto b : touched) {
+        auto nb = p.split(b);
+        if (nb == -1) continue;
+        in_worklist.push_back(false);
+        if (at(in_worklist, b) || p.get_size(nb) <= p.get_size(b)) {
+          worklist.push_back(nb);
+          at(in_worklist, nb) = true;
+        } else {
+          worklist.push_back(b);
+          at(in_worklist, b) = true;
+        }
+      }
+    }
+  }
+  /* number the blocks reachable from the start state in
+     breadth-first order, which keeps the start state at 0 and
+     drops unreachable and dead states */
+  auto dead_block = at(p.block_of, dead);
+  auto new_states = make_vector<int>(p.get_nblocks(), -1);
+  std::vector<int> representatives;
+  if (nstates != 0) {
+    at(new_states, at(p.block_of, 0)) = 0;
+    representatives.push_back(0);
+  }
+  auto const start_is_dead =
+      nstates == 0 || at(p.block_of, 0) == dead_block;
+  for (int front = 0;
+       !start_is_dead && front < isize(representatives); ++front) {
+    auto state = at(representatives, front);
+    for (int symbol = 0; symbol < nsymbols; ++symbol) {
+      auto next = step(fa, state, symbol);
+      if (next == -1) continue;
+      auto next_block = at(p.block_of, next);
+      if (next_block == dead_block || at(new_states, next_block) != -1) {
+        continue;
+      }
+      at(new_states, next_block) = isize(representatives);
+      representatives.push_back(next);
+    }
+  }
+  finite_automaton out(nsymbols, true, isize(representatives));
+  for (int i = 0; i < isize(representatives); ++i) add_state(out);
+  if (start_is_dead) return out;
+  for (int new_state = 0; new_state < isize(representatives); ++new_state) {
+    auto state = at(representatives, new_state);
+    for (int symbol = 0; symbol < nsymbols; ++symbol) {
+      auto next = step(fa, state, symbol);
+      if (next == -1) continue;
+      auto next_block = at(p.block_of, next);
+      if (next_block == dead_block) continue;
+      add_transition(out, new_state, symbol, at(new_states, next_block));
+    }
+    auto token = accepts(fa, state);
+    if (token != -1) add_accept(out, new_state, token);
+  }
+  return out;
+}
+
 finite_automaton finite_automaton::simplify(finite_automaton const& fa) {
+  if (get_determinism(fa)) return minimize(fa);
+  /* for an NFA, we can still merge states with identical rows */
   finite_automaton out = fa;
   int nstates_new = get_nstates(fa);
   int nstates;
@@ -438,61 +1112,32 @@ void add_char_transition(
   add_transition(fa, from_state, get_symbol(at_char), to_state);
 }
 
-template <typename T, bool is_signed = std::numeric_limits<T>::is_signed>
-struct is_symbol_helper;
-
-template <typename T>
-struct is_symbol_helper<T, true> {
-  static bool eval(T c) {
-    if (c < 0) return false;
-    return 0 <= parsegen::chartab[int(c)];
-  }
-};
-
-template <typename T>
-struct is_symbol_helper<T, false> {
-  static bool eval(T c) {
-    if (c >= PARSEGEN_CHARTAB_SIZE) return false;
-    return 0 <= parsegen::chartab[int(c)];
-  }
-};
-
-bool is_symbol(char c) { return is_symbol_helper<char>::eval(c); }
+bool is_symbol(char c) { return get_symbol(c) < parsegen::NCHARS; }
 
-template <typename T, bool is_signed = std::numeric_limits<T>::is_signed>
-struct get_symbol_helper;
+bool is_symbol(char c, int nsymbols) { return get_symbol(c) < nsymbols; }
 
-template <typename T>
-struct get_symbol_helper<T, true> {
-  static int eval(T c) {
-    assert(0 <= c);
-    int symbol = parsegen::chartab[int(c)];
-    assert(0 <= symbol);
-    return symbol;
-  }
-};
-
-template <typename T>
-struct get_symbol_helper<T, false> {
-  static int eval(T c) {
-    int symbol = parsegen::chartab[int(c)];
-    assert(0 <= symbol);
-    return symbol;
-  }
-};
-
-int get_symbol(char c) { return get_symbol_helper<char>::eval(c); }
+int get_symbol(char c) {
+  return parsegen::chartab[static_cast<unsigned char>(c)];
+}
 
 char get_char(int symbol) {
   assert(0 <= symbol);
-  assert(symbol < parsegen::NCHARS);
+  assert(symbol < parsegen::NBYTES);
   return inv_chartab[symbol];
 }
 
 finite_automaton make_char_set_nfa(std::set<char> const& accepted, int token) {
+  return make_char_set_nfa(parsegen::NCHARS, accepted, token);
+}
+
+finite_automaton make_char_set_nfa(
+    int nsymbols, std::set<char> const& accepted, int token) {
   std::set<int> symbol_set;
-  for (auto c : accepted) symbol_set.insert(get_symbol(c));
-  return finite_automaton::make_set_nfa(parsegen::NCHARS, symbol_set, token);
+  for (auto c : accepted) {
+    assert(is_symbol(c, nsymbols));
+    symbol_set.insert(get_symbol(c));
+  }
+  return finite_automaton::make_set_nfa(nsymbols, symbol_set, token);
 }
 
 finite_automaton make_char_range_nfa(
@@ -502,13 +1147,23 @@ finite_automaton make_char_range_nfa(
 }
 
 finite_automaton make_char_single_nfa(char symbol_char, int token) {
+  return make_char_single_nfa(parsegen::NCHARS, symbol_char, token);
+}
+
+finite_automaton make_char_single_nfa(
+    int nsymbols, char symbol_char, int token) {
+  assert(is_symbol(symbol_char, nsymbols));
   return finite_automaton::make_range_nfa(
-      parsegen::NCHARS, get_symbol(symbol_char), get_symbol(symbol_char), token);
+      nsymbols, get_symbol(symbol_char), get_symbol(symbol_char), token);
 }
 
 std::set<char> negate_set(std::set<char> const& s) {
+  return negate_set(s, parsegen::NCHARS);
+}
+
+std::set<char> negate_set(std::set<char> const& s, int nsymbols) {
   std::set<char> out;
-  for (int symbol = 0; symbol < NCHARS; ++symbol) {
+  for (int symbol = 0; symbol < nsymbols; ++symbol) {
     auto c = inv_chartab[symbol];
     if (!s.count(c)) out.insert(c);
   }
@@ -520,6 +1175,11 @@ std::string escape_char(char c)
   if (c == '\t') return "\\t";
   if (c == '\n') return "\\n";
   if (c == '\r') return "\\r";
+  if (!is_symbol(c)) {
+    char const* digits = "0123456789abcdef";
+    auto byte = static_cast<unsigned char>(c);
+    return std::string("\\x") + digits[byte / 16] + digits[byte % 16];
+  }
   return std::string(1, c);
 }
 
@@ -555,7 +1215,7 @@ bool accepts(
     finite_automaton const& fa, std::string const& s, int token) {
   int state = 0;
   for (auto c : s) {
-    if (!is_symbol(c)) {
+    if (!is_symbol(c, get_nsymbols(fa))) {
       return false;
     }
     auto symbol = get_symbol(c);
@@ -565,4 +1225,17 @@ bool accepts(
   return accepts(fa, state) == token;
 }
 
+bool accepts(lazy_dfa& dfa, std::string const& s, int token) {
+  int state = dfa.get_start_state();
+  for (auto c : s) {
+    if (!is_symbol(c, dfa.get_nsymbols())) {
+      return false;
+    }
+    auto symbol = get_symbol(c);
+    state = dfa.step(state, symbol);
+    if (state == -1) return false;
+  }
+  return dfa.accepts(state) == token;
+}
+
 }  // end namespace parsegen
@@ -3,11 +3,14 @@
 
 #include "parsegen_table.hpp"
 #include <iosfwd>
+#include <memory>
 #include <set>
 #include <string>
 
 namespace parsegen {
 
+struct sparse_nfa;
+
 /* This is basically a weird mix between a DFA and
    an NFA-epsilon. It is really a DFA that can have two extra
    epsilon symbols that it accepts transitions with.
@@ -39,6 +42,13 @@ struct finite_automaton {
   static finite_automaton star(finite_automaton const& a, int token = 0);
   static finite_automaton make_rolling(finite_automaton const& a);
   static finite_automaton make_deterministic(finite_automaton const& nfa);
+  static finite_automaton make_deterministic(
+      finite_automaton const& nfa, int nthreads);
+  static finite_automaton make_deterministic(sparse_nfa const& nfa);
+  static finite_automaton make_deterministic(
+      sparse_nfa const& nfa, int nthreads);
+  static finite_automaton unite_deterministic(
+      finite_automaton const& a, finite_automaton const& b);
   static finite_automaton simplify_once(finite_automaton const& fa);
   static finite_automaton simplify(finite_automaton const& fa);
 };
@@ -61,24 +71,113 @@ void negate_acceptance(finite_automaton& fa);
 finite_automaton add_death_state(finite_automaton const& a);
 finite_automaton remove_transitions_from_accepting(finite_automaton const& a);
 
+/* Thompson NFA states have only one or two outgoing transitions,
+   so most cells of a non-deterministic finite_automaton are -1.
+   A sparse_nfa is just a list of edges, and is what regexes and
+   lexers are assembled in before make_deterministic turns them into
+   a dense DFA. A state may have any number of epsilon transitions,
+   which are edges at the symbol get_epsilon(nfa).
+   by convention, the start state is state 0 */
+struct nfa_edge {
+  int from_state;
+  int symbol;
+  int to_state;
+};
+
+struct sparse_nfa {
+  int nsymbols;
+  std::vector<int> accepted_tokens;
+  std::vector<nfa_edge> edges;
+  sparse_nfa() = default;
+  sparse_nfa(int nsymbols_init, int nstates_reserve);
+};
+
+int get_nstates(sparse_nfa const& nfa);
+int get_nsymbols(sparse_nfa const& nfa);
+int get_epsilon(sparse_nfa const& nfa);
+int add_state(sparse_nfa& nfa);
+void add_transition(sparse_nfa& nfa, int from_state, int at_symbol, int to_state);
+void add_accept(sparse_nfa& nfa, int state, int token);
+int accepts(sparse_nfa const& nfa, int state);
+void append_states(sparse_nfa& nfa, finite_automaton const& other);
+void append_states(sparse_nfa& nfa, sparse_nfa const& other);
+sparse_nfa make_sparse(finite_automaton const& fa);
+
+/* on-the-fly determinization: the DFA states of an NFA are only
+   constructed when the input reaches them, and at most about
+   max_cached_states of them are kept. When the cache is full it is
+   flushed, keeping only the state being stepped from, so a regex whose
+   full DFA would be huge runs in bounded memory.
+   A flush renumbers the states, so only the state returned by the
+   latest call to get_start_state or step should be kept.
+   step returns -1 for the dead state, and accepts returns the token
+   the state accepts (the lowest one if several do) or -1 */
+class lazy_dfa {
+ public:
+  lazy_dfa(sparse_nfa const& nfa, int max_cached_states = 10000);
+  lazy_dfa(lazy_dfa&&) = default;
+  ~lazy_dfa();
+  int get_start_state();
+  int step(int state, int symbol);
+  int accepts(int state) const;
+  int get_nsymbols() const;
+  int get_ncached_states() const;
+  int get_nflushes() const;
+
+ private:
+  struct cache;
+  std::unique_ptr<cache> data;
+};
+
+/* profile-guided state ordering for lexer DFAs.
+   count_state_visits runs the longest-match tokenizer over some
+   training text and adds the number of times each state was entered
+   to (visits).
+   get_hot_state_order lists the states (start state first) so that
+   frequently visited states are contiguous and each one is followed
+   by its most frequently visited successor.
+   reorder_states renumbers a DFA given such an order, where
+   order[new_state] = old_state */
+void count_state_visits(finite_automaton const& fa, std::string const& text,
+    std::vector<long>& visits);
+std::vector<int> get_hot_state_order(
+    finite_automaton const& fa, std::vector<long> const& visits);
+finite_automaton reorder_states(
+    finite_automaton const& fa, std::vector<int> const& order);
+finite_automaton reorder_by_profile(
+    finite_automaton const& fa, std::vector<std::string> const& corpus);
+
 finite_automaton make_char_nfa(
     bool is_deterministic_init, int nstates_reserve);
 void add_char_transition(
     finite_automaton& fa, int from_state, char at_char, int to_state);
+/* character symbols: every byte has a symbol, and the ASCII
+   characters we support have the first NCHARS symbols.
+   is_symbol(c) checks for those ASCII characters, while
+   is_symbol(c, nsymbols) checks against the alphabet of an automaton,
+   which is either NCHARS (ASCII) or NBYTES (any byte, i.e. UTF-8 text
+   passes through byte by byte) */
 bool is_symbol(char c);
+bool is_symbol(char c, int nsymbols);
 int get_symbol(char c);
 char get_char(int symbol);
 finite_automaton make_char_set_nfa(
     std::set<char> const& accepted, int token = 0);
+finite_automaton make_char_set_nfa(
+    int nsymbols, std::set<char> const& accepted, int token);
 finite_automaton make_char_range_nfa(
     char range_start, char range_end, int token = 0);
 finite_automaton make_char_single_nfa(
     char symbol_char, int token = 0);
+finite_automaton make_char_single_nfa(
+    int nsymbols, char symbol_char, int token);
 std::set<char> negate_set(std::set<char> const& s);
+std::set<char> negate_set(std::set<char> const& s, int nsymbols);
 
 std::ostream& operator<<(std::ostream& os, finite_automaton const& fa);
 bool accepts(
     finite_automaton const& fa, std::string const& s, int token = 0);
+bool accepts(lazy_dfa& dfa, std::string const& s, int token = 0);
 
 }  // namespace parsegen
 
@@ -1,8 +1,8 @@
 #include "parsegen_grammar.hpp"
 
 #include <iostream>
-#include <set>
 
+#include "parsegen_parser_graph.hpp"
 #include "parsegen_std_vector.hpp"
 
 namespace parsegen {
@@ -24,16 +24,16 @@ int as_nonterminal(grammar const& g, int symbol) {
 }
 
 int find_goal_symbol(grammar const& g) {
-  std::set<int> nonterminals_in_rhss;
+  auto is_in_rhs = make_vector<bool>(get_nnonterminals(g), false);
   for (auto& p : g.productions) {
     for (auto s : p.rhs) {
       assert(0 <= s);
-      if (is_nonterminal(g, s)) nonterminals_in_rhss.insert(s);
+      if (is_nonterminal(g, s)) at(is_in_rhs, as_nonterminal(g, s)) = true;
     }
   }
   int result = -1;
   for (int s = g.nterminals; s < g.nsymbols; ++s)
-    if (!nonterminals_in_rhss.count(s)) {
+    if (!at(is_in_rhs, as_nonterminal(g, s))) {
       if (result != -1) {
         std::cerr << "ERROR: there is more than one root nonterminal (";
         std::cerr << at(g.symbol_names, result) << " and "
@@ -57,6 +57,7 @@ void add_end_terminal(grammar& g) {
     }
   }
   g.symbol_names.insert(g.symbol_names.begin() + g.nterminals, "EOF");
+  if (!g.terminal_precedences.empty()) g.terminal_precedences.push_back(-1);
   g.nterminals++;
   g.nsymbols++;
 }
@@ -77,6 +78,103 @@ int get_accept_production(grammar const& g) { return isize(g.productions) - 1; }
 
 int get_accept_nonterminal(grammar const& g) { return g.nsymbols - 1; }
 
+grammar_ptr prune_grammar(grammar const& g, grammar_pruning& pruning) {
+  auto nproductions = isize(g.productions);
+  /* a production derives a string of terminals once all its RHS
+     symbols do, so count down the RHS symbols not yet known to */
+  auto is_productive = make_vector<bool>(g.nsymbols, false);
+  edge_list rhs_edges;
+  edge_list lhs_edges;
+  auto nremaining = make_vector<int>(nproductions, 0);
+  std::vector<int> found;
+  for (int t = 0; t < g.nterminals; ++t) {
+    at(is_productive, t) = true;
+    found.push_back(t);
+  }
+  for (int prod_i = 0; prod_i < nproductions; ++prod_i) {
+    auto& prod = at(g.productions, prod_i);
+    at(nremaining, prod_i) = isize(prod.rhs);
+    for (auto symbol : prod.rhs) rhs_edges.push_back({symbol, prod_i});
+    lhs_edges.push_back({prod.lhs, prod_i});
+    if (prod.rhs.empty() && !at(is_productive, prod.lhs)) {
+      at(is_productive, prod.lhs) = true;
+      found.push_back(prod.lhs);
+    }
+  }
+  auto rhs2prods = make_csr_graph(g.nsymbols, rhs_edges);
+  while (!found.empty()) {
+    auto symbol = found.back();
+    found.pop_back();
+    for (auto prod_i : get_edges(rhs2prods, symbol)) {
+      if (--at(nremaining, prod_i) != 0) continue;
+      auto lhs = at(g.productions, prod_i).lhs;
+      if (at(is_productive, lhs)) continue;
+      at(is_productive, lhs) = true;
+      found.push_back(lhs);
+    }
+  }
+  /* the productions of reachable nonterminals that derive strings of
+     terminals make their RHS symbols reachable. The accept production
+     is always kept, even if the language is empty. */
+  auto lhs2prods = make_csr_graph(g.nsymbols, lhs_edges);
+  auto is_kept_production = make_vector<bool>(nproductions, false);
+  auto is_kept_symbol = make_vector<bool>(g.nsymbols, false);
+  at(is_kept_symbol, get_end_terminal(g)) = true;
+  for (auto terminal : g.ignored_terminals) at(is_kept_symbol, terminal) = true;
+  at(is_kept_symbol, get_accept_nonterminal(g)) = true;
+  std::vector<int> reached = {get_accept_nonterminal(g)};
+  while (!reached.empty()) {
+    auto nonterminal = reached.back();
+    reached.pop_back();
+    for (auto prod_i : get_edges(lhs2prods, nonterminal)) {
+      auto& prod = at(g.productions, prod_i);
+      if (at(nremaining, prod_i) != 0 && prod_i != get_accept_production(g)) {
+        continue;
+      }
+      at(is_kept_production, prod_i) = true;
+      for (auto symbol : prod.rhs) {
+        if (at(is_kept_symbol, symbol)) continue;
+        at(is_kept_symbol, symbol) = true;
+        if (is_nonterminal(g, symbol)) reached.push_back(symbol);
+      }
+    }
+  }
+  auto new_symbols = make_vector<int>(g.nsymbols, -1);
+  pruning.kept_symbols.clear();
+  pruning.kept_productions.clear();
+  grammar out;
+  out.nterminals = 0;
+  for (int symbol = 0; symbol < g.nsymbols; ++symbol) {
+    if (!at(is_kept_symbol, symbol)) continue;
+    at(new_symbols, symbol) = isize(pruning.kept_symbols);
+    pruning.kept_symbols.push_back(symbol);
+    out.symbol_names.push_back(at(g.symbol_names, symbol));
+    if (is_terminal(g, symbol)) {
+      ++out.nterminals;
+      if (!g.terminal_precedences.empty()) {
+        out.terminal_precedences.push_back(at(g.terminal_precedences, symbol));
+      }
+    }
+  }
+  out.associativities = g.associativities;
+  out.nsymbols = isize(pruning.kept_symbols);
+  for (int prod_i = 0; prod_i < nproductions; ++prod_i) {
+    if (!at(is_kept_production, prod_i)) continue;
+    auto& prod = at(g.productions, prod_i);
+    grammar::production new_prod;
+    new_prod.lhs = at(new_symbols, prod.lhs);
+    new_prod.precedence = prod.precedence;
+    new_prod.builtin = prod.builtin;
+    for (auto symbol : prod.rhs) new_prod.rhs.push_back(at(new_symbols, symbol));
+    out.productions.push_back(std::move(new_prod));
+    pruning.kept_productions.push_back(prod_i);
+  }
+  for (auto terminal : g.ignored_terminals) {
+    out.ignored_terminals.push_back(at(new_symbols, terminal));
+  }
+  return std::make_shared<grammar>(std::move(out));
+}
+
 std::ostream& operator<<(std::ostream& os, grammar const& g) {
   os << "symbols:\n";
   for (int i = 0; i < isize(g.symbol_names); ++i) {
@@ -7,6 +7,25 @@
 
 namespace parsegen {
 
+/* how operators of the same precedence level group:
+   a - b - c is (a - b) - c if - is left associative,
+   a ^ b ^ c is a ^ (b ^ c) if ^ is right associative,
+   and a < b < c is an error if < is not associative */
+enum class associativity { left, right, nonassoc };
+
+/* the productions build_grammar adds for the repetition operators,
+   whose values the parser makes itself instead of calling reduce:
+   those of X* and X+ are a std::vector<std::any> of the values of
+   the X's in order, and that of X? is the value of X, or empty */
+enum class builtin_reduction {
+  none,
+  empty_list,
+  first_item,
+  next_item,
+  absent,
+  present
+};
+
 /* convention: symbols are numbered with all
    terminal symbols first, all non-terminal symbols after */
 
@@ -15,6 +34,9 @@ struct grammar {
   struct production {
     int lhs;
     right_hand_side rhs;
+    /* its precedence level, or -1 */
+    int precedence = -1;
+    builtin_reduction builtin = builtin_reduction::none;
   };
   using production_vector = std::vector<production>;
   int nsymbols;
@@ -22,6 +44,11 @@ struct grammar {
   production_vector productions;
   std::vector<std::string> symbol_names;
   std::vector<int> ignored_terminals;
+  /* by terminal, its precedence level, or -1. Empty if no precedence
+     is declared. Levels are numbered from the loosest binding. */
+  std::vector<int> terminal_precedences;
+  /* by precedence level */
+  std::vector<associativity> associativities;
 };
 
 using grammar_ptr = std::shared_ptr<grammar const>;
@@ -37,6 +64,21 @@ void add_accept_production(grammar& g);
 int get_accept_production(grammar const& g);
 int get_accept_nonterminal(grammar const& g);
 
+/* which symbols and productions of a grammar were kept by
+   prune_grammar, by their number in the pruned grammar */
+struct grammar_pruning {
+  std::vector<int> kept_symbols;
+  std::vector<int> kept_productions;
+};
+
+/* the grammar without what cannot take part in deriving a sentence
+   from the goal symbol: nonterminals that derive no string of
+   terminals or are not reachable from the goal, the productions that
+   use those, and terminals that are in none of the other productions
+   and are not ignored. What is kept is numbered in the same order,
+   so EOF and the accept production stay last. */
+grammar_ptr prune_grammar(grammar const& g, grammar_pruning& pruning);
+
 std::ostream& operator<<(std::ostream& os, grammar const& g);
 
 }  // namespace parsegen
@@ -4,8 +4,10 @@
 #include <iostream>
 #include <set>
 #include <sstream>
+#include <unordered_map>
 
 #include "parsegen_build_parser.hpp"
+#include "parsegen_chartab.hpp"
 #include "parsegen_regex.hpp"
 #include "parsegen_std_vector.hpp"
 #include "parsegen_string.hpp"
@@ -14,7 +16,10 @@
 namespace parsegen {
 
 grammar_ptr build_grammar(language const& language) {
-  std::map<std::string, int> symbol_map;
+  /* hashed, since generated languages have tens of thousands of
+     productions and each of their symbols is looked up once */
+  std::unordered_map<std::string, int> symbol_map;
+  symbol_map.reserve(language.tokens.size() + language.productions.size());
   int nterminals = 0;
   for (auto& token : language.tokens) {
     symbol_map[token.name] = nterminals++;
@@ -27,28 +32,125 @@ grammar_ptr build_grammar(language const& language) {
         << " has empty left hand side\n";
       abort();
     }
-    if (symbol_map.count(production.lhs)) continue;
-    symbol_map[production.lhs] = nsymbols++;
+    if (symbol_map.emplace(production.lhs, nsymbols).second) ++nsymbols;
   }
   grammar out;
   out.nsymbols = nsymbols;
   out.nterminals = nterminals;
+  auto find_token = [&](std::string const& name, char const* what) {
+    auto const it = symbol_map.find(name);
+    if (it == symbol_map.end() || it->second >= nterminals) {
+      throw std::invalid_argument(
+          std::string(what) + " \"" + name + "\" is not a token!\n");
+    }
+    return it->second;
+  };
+  if (!language.precedence_levels.empty()) {
+    out.terminal_precedences = make_vector<int>(nterminals, -1);
+  }
+  /* the names in precedence levels that are not symbols, by level,
+     which only %prec can use */
+  std::unordered_map<std::string, int> precedence_tags;
+  for (auto& level : language.precedence_levels) {
+    for (auto& name : level.tokens) {
+      if (symbol_map.count(name) == 0) {
+        precedence_tags[name] = isize(out.associativities);
+        continue;
+      }
+      at(out.terminal_precedences, find_token(name, "precedence token")) =
+          isize(out.associativities);
+    }
+    out.associativities.push_back(level.associativity);
+  }
+  /* the productions of repetitions, numbered after those of (language) */
+  grammar::production_vector repetition_productions;
+  auto add_repetition = [&](int symbol, char op, std::string const& name) {
+    auto const lhs = nsymbols++;
+    symbol_map.emplace(name, lhs);
+    auto add = [&](grammar::right_hand_side rhs, builtin_reduction builtin) {
+      grammar::production prod;
+      prod.lhs = lhs;
+      prod.rhs = std::move(rhs);
+      prod.builtin = builtin;
+      repetition_productions.push_back(std::move(prod));
+    };
+    if (op == '?') {
+      add({}, builtin_reduction::absent);
+      add({symbol}, builtin_reduction::present);
+    } else {
+      if (op == '*') {
+        add({}, builtin_reduction::empty_list);
+      } else {
+        add({symbol}, builtin_reduction::first_item);
+      }
+      add({lhs, symbol}, builtin_reduction::next_item);
+    }
+    return lhs;
+  };
+  auto is_repetition = [](char c) { return c == '*' || c == '+' || c == '?'; };
+  /* the symbol named (name), or -1. A name that is not declared but is
+     a declared one followed by repetition operators gets their
+     nonterminals, innermost first */
+  auto find_symbol = [&](std::string const& name) {
+    auto const it = symbol_map.find(name);
+    if (it != symbol_map.end()) return it->second;
+    auto stem_size = name.size();
+    while (stem_size > 1 && is_repetition(name[stem_size - 1])) {
+      --stem_size;
+      auto const stem_it = symbol_map.find(name.substr(0, stem_size));
+      if (stem_it == symbol_map.end()) continue;
+      auto symbol = stem_it->second;
+      for (; stem_size < name.size(); ++stem_size) {
+        symbol = add_repetition(
+            symbol, name[stem_size], name.substr(0, stem_size + 1));
+      }
+      return symbol;
+    }
+    return -1;
+  };
+  out.productions.reserve(language.productions.size());
   for (auto& lang_prod : language.productions) {
     grammar::production gprod;
-    assert(symbol_map.count(lang_prod.lhs));
-    gprod.lhs = symbol_map[lang_prod.lhs];
+    auto const lhs_it = symbol_map.find(lang_prod.lhs);
+    assert(lhs_it != symbol_map.end());
+    gprod.lhs = lhs_it->second;
+    gprod.rhs.reserve(lang_prod.rhs.size());
     for (auto& lang_symb : lang_prod.rhs) {
-      if (!symbol_map.count(lang_symb)) {
+      auto const symbol = find_symbol(lang_symb);
+      if (symbol == -1) {
         std::stringstream ss;
         ss << "RHS entry \"" << lang_symb
            << "\" is neither a nonterminal (LHS of a production) nor a "
               "token!\n";
         throw std::invalid_argument(ss.str());
       }
-      gprod.rhs.push_back(symbol_map[lang_symb]);
+      gprod.rhs.push_back(symbol);
+      if (symbol < nterminals && !out.terminal_precedences.empty() &&
+          at(out.terminal_precedences, symbol) != -1) {
+        gprod.precedence = at(out.terminal_precedences, symbol);
+      }
+    }
+    if (!lang_prod.precedence.empty()) {
+      auto const tag_it = precedence_tags.find(lang_prod.precedence);
+      if (tag_it != precedence_tags.end()) {
+        gprod.precedence = tag_it->second;
+      } else {
+        auto const token =
+            find_token(lang_prod.precedence, "production precedence");
+        if (out.terminal_precedences.empty() ||
+            at(out.terminal_precedences, token) == -1) {
+          throw std::invalid_argument("production precedence \"" +
+              lang_prod.precedence + "\" has no precedence level!\n");
+        }
+        gprod.precedence = at(out.terminal_precedences, token);
+      }
     }
     out.productions.emplace_back(std::move(gprod));
   }
+  for (auto& prod : repetition_productions) {
+    out.productions.emplace_back(std::move(prod));
+  }
+  out.nsymbols = nsymbols;
   out.symbol_names = make_vector<std::string>(nsymbols);
   for (auto& pair : symbol_map) {
     at(out.symbol_names, pair.second) = pair.first;
@@ -69,6 +171,21 @@ std::ostream& operator<<(std::ostream& os, language const& lang) {
   for (auto& token : lang.tokens) {
     os << "token " << token.name << " regex " << single_quote(token.regex) << "\n";
   }
+  for (auto& level : lang.precedence_levels) {
+    switch (level.associativity) {
+      case associativity::left:
+        os << "left";
+        break;
+      case associativity::right:
+        os << "right";
+        break;
+      case associativity::nonassoc:
+        os << "nonassoc";
+        break;
+    }
+    for (auto& name : level.tokens) os << " " << name;
+    os << "\n";
+  }
   std::set<std::string> nonterminal_set;
   std::vector<std::string> nonterminal_list;
   for (auto& prod : lang.productions) {
@@ -96,6 +213,7 @@ std::ostream& operator<<(std::ostream& os, language const& lang) {
         else
           os << " " << symb;
       }
+      if (!prod.precedence.empty()) os << " %prec " << prod.precedence;
     }
     os << "\n";
   }
@@ -104,27 +222,110 @@ std::ostream& operator<<(std::ostream& os, language const& lang) {
 }
 
 finite_automaton build_lexer(language const& language) {
-  finite_automaton lexer;
+  return build_lexer(language, 1);
+}
+
+static void check_token(language const& language, int i) {
+  auto& name = at(language.tokens, i).name;
+  auto& regex = at(language.tokens, i).regex;
+  if (name.empty()) {
+    std::cerr << "ERROR: token "
+      << i << " has empty name\n";
+    abort();
+  }
+  if (regex.empty()) {
+    std::cerr << "ERROR: token "
+      << i << " has empty regex\n";
+    abort();
+  }
+}
+
+finite_automaton build_lexer(language const& language, int nthreads) {
+  auto nsymbols = language.uses_byte_alphabet ? NBYTES : NCHARS;
+  /* the start state has an epsilon transition to each token's DFA */
+  sparse_nfa lexer(nsymbols, 1);
+  add_state(lexer);
   for (int i = 0; i < isize(language.tokens); ++i) {
-    auto& name = at(language.tokens, i).name;
-    auto& regex = at(language.tokens, i).regex;
-    if (name.empty()) {
-      std::cerr << "ERROR: token "
-        << i << " has empty name\n";
-      abort();
-    }
-    if (regex.empty()) {
-      std::cerr << "ERROR: token "
-        << i << " has empty regex\n";
-      abort();
+    check_token(language, i);
+    auto& token = at(language.tokens, i);
+    auto offset = get_nstates(lexer);
+    append_states(lexer, regex::build_dfa(token.name, token.regex, i, nsymbols));
+    add_transition(lexer, 0, get_epsilon(lexer), offset);
+  }
+  return finite_automaton::simplify(
+      finite_automaton::make_deterministic(lexer, nthreads));
+}
+
+static bool is_same_token(
+    language::token const& a, language::token const& b) {
+  return a.name == b.name && a.regex == b.regex;
+}
+
+/* the cached DFA of a token's regex accepts token 0 */
+static finite_automaton get_token_dfa(
+    language const& language, int i, lexer_cache& cache) {
+  check_token(language, i);
+  auto& token = at(language.tokens, i);
+  auto it = cache.regex_dfas.find(token.regex);
+  if (it == cache.regex_dfas.end()) {
+    auto nsymbols = language.uses_byte_alphabet ? NBYTES : NCHARS;
+    auto dfa = regex::build_dfa(token.name, token.regex, 0, nsymbols);
+    it = cache.regex_dfas.emplace(token.regex, std::move(dfa)).first;
+  }
+  auto out = it->second;
+  for (auto& accepted : out.accepted_tokens) {
+    if (accepted != -1) accepted = i;
+  }
+  return out;
+}
+
+finite_automaton build_lexer(language const& language, lexer_cache& cache) {
+  if (cache.uses_byte_alphabet != language.uses_byte_alphabet) {
+    cache = lexer_cache();
+    cache.uses_byte_alphabet = language.uses_byte_alphabet;
+  }
+  auto nold = isize(cache.tokens);
+  bool is_extension = 0 < nold && nold <= isize(language.tokens);
+  for (int i = 0; is_extension && i < nold; ++i) {
+    is_extension = is_same_token(at(cache.tokens, i), at(language.tokens, i));
+  }
+  finite_automaton lexer;
+  if (is_extension) {
+    lexer = cache.lexer;
+    for (int i = nold; i < isize(language.tokens); ++i) {
+      lexer = finite_automaton::simplify(finite_automaton::unite_deterministic(
+          lexer, get_token_dfa(language, i, cache)));
     }
-    if (i == 0) {
-      lexer = regex::build_dfa(name, regex, i);
-    } else {
-      lexer = finite_automaton::unite(lexer, regex::build_dfa(name, regex, i));
+  } else {
+    auto nsymbols = language.uses_byte_alphabet ? NBYTES : NCHARS;
+    sparse_nfa lexer_nfa(nsymbols, 1);
+    add_state(lexer_nfa);
+    for (int i = 0; i < isize(language.tokens); ++i) {
+      auto offset = get_nstates(lexer_nfa);
+      append_states(lexer_nfa, get_token_dfa(language, i, cache));
+      add_transition(lexer_nfa, 0, get_epsilon(lexer_nfa), offset);
     }
+    lexer = finite_automaton::simplify(
+        finite_automaton::make_deterministic(lexer_nfa));
+  }
+  /* only update the cache once nothing can throw */
+  cache.lexer = lexer;
+  cache.tokens = language.tokens;
+  return lexer;
+}
+
+sparse_nfa build_lexer_nfa(language const& language) {
+  auto nsymbols = language.uses_byte_alphabet ? NBYTES : NCHARS;
+  sparse_nfa lexer(nsymbols, 1);
+  add_state(lexer);
+  for (int i = 0; i < isize(language.tokens); ++i) {
+    check_token(language, i);
+    auto& token = at(language.tokens, i);
+    auto token_nfa = regex::build_nfa(token.name, token.regex, i, nsymbols);
+    auto offset = get_nstates(lexer);
+    append_states(lexer, token_nfa);
+    add_transition(lexer, 0, get_epsilon(lexer), offset);
   }
-  lexer = finite_automaton::simplify(finite_automaton::make_deterministic(lexer));
   return lexer;
 }
 
@@ -174,12 +375,63 @@ static indentation build_indent_info(language const& language) {
   return out;
 }
 
-parser_tables_ptr build_parser_tables(language const& language) {
+/* the LALR(1) tables of (grammar), built from its pruned grammar */
+static shift_reduce_tables build_syntax_tables(grammar_ptr grammar,
+    grammar_pruning const& pruning, grammar_ptr pruned,
+    bool minimize = false, lalr1_method method = lalr1_method::lane_tracing) {
+  auto tables = accept_parser(build_lalr1_parser(pruned, method));
+  if (minimize) tables = minimize_states(tables);
+  auto out = unprune_tables(tables, grammar, pruning);
+  add_reduce_chains(out);
+  compress_if_sparse(out);
+  return out;
+}
+
+parser_tables_ptr build_parser_tables(
+    language const& language, bool minimize, lalr1_method method) {
+  auto indent_info = build_indent_info(language);
+  auto grammar = build_grammar(language);
+  grammar_pruning pruning;
+  auto pruned = prune_grammar(*grammar, pruning);
+  auto lexer = build_lexer(language);
+  auto parser = build_syntax_tables(grammar, pruning, pruned, minimize, method);
+  return parser_tables_ptr(
+      new parser_tables({parser, lexer, indent_info, nullptr, 0}));
+}
+
+parser_tables_ptr build_parser_tables(language const& language,
+    std::vector<std::string> const& lexer_training_corpus) {
+  auto tables = build_parser_tables(language);
+  auto lexer =
+      reorder_by_profile(tables->lexical_tables, lexer_training_corpus);
+  return parser_tables_ptr(new parser_tables(
+      {tables->syntax_tables, lexer, tables->indent_info, nullptr, 0}));
+}
+
+parser_tables_ptr build_lazy_parser_tables(language const& language) {
   auto lexer = build_lexer(language);
   auto indent_info = build_indent_info(language);
   auto grammar = build_grammar(language);
-  auto parser = accept_parser(build_lalr1_parser(grammar));
-  return parser_tables_ptr(new parser_tables({parser, lexer, indent_info}));
+  /* lazy rows are only built for states that are entered anyway,
+     so the grammar is not pruned */
+  auto parser = build_lazy_lr1_tables(grammar);
+  return parser_tables_ptr(
+      new parser_tables({parser, lexer, indent_info, nullptr, 0}));
+}
+
+parser_tables_ptr build_parser_tables_with_lazy_lexer(
+    language const& language, int max_cached_states) {
+  auto indent_info = build_indent_info(language);
+  auto grammar = build_grammar(language);
+  grammar_pruning pruning;
+  auto pruned = prune_grammar(*grammar, pruning);
+  auto parser = build_syntax_tables(grammar, pruning, pruned);
+  auto out = std::make_shared<parser_tables>();
+  out->syntax_tables = std::move(parser);
+  out->indent_info = indent_info;
+  out->lexer_nfa = std::make_shared<sparse_nfa>(build_lexer_nfa(language));
+  out->lexer_max_cached_states = max_cached_states;
+  return out;
 }
 
 }  // namespace parsegen
@@ -19,11 +19,38 @@ struct language {
   };
   std::vector<token> tokens;
   std::vector<std::string> ignored_tokens;
+  /* a right hand side entry that is not a declared symbol but is one
+     followed by *, + or ? means zero or more, one or more, or an
+     optional one of it. build_grammar adds a nonterminal by that name,
+     whose productions come after these ones and are left recursive,
+     so a long list does not grow the parser stack. Its value is made
+     by the parser (see builtin_reduction), not by reduce. */
   struct production {
     std::string lhs;
     std::vector<std::string> rhs;
+    /* a production has the precedence level of the last token in its
+       right hand side that has one, or of this token or tag if it is
+       named, as for a unary minus that binds tighter than a binary one */
+    std::string precedence = "";
   };
   std::vector<production> productions;
+  /* operator precedence, from the loosest binding level to the
+     tightest. A shift/reduce conflict between a token and a
+     production that both have a level is resolved by them instead of
+     being an error, so an expression grammar can be one nonterminal
+     with a production per operator. A name in a level that is not a
+     symbol is a tag, which productions can only name as their
+     precedence, and which the lexer never sees. */
+  struct precedence_level {
+    parsegen::associativity associativity;
+    std::vector<std::string> tokens;
+  };
+  std::vector<precedence_level> precedence_levels;
+  /* by default the lexer only reads ASCII text.
+     with a byte alphabet it reads any byte, and "." and negated
+     character sets in token regexes also match non-ASCII bytes,
+     so UTF-8 text can pass through comments, quoted strings, etc. */
+  bool uses_byte_alphabet = false;
 };
 
 using language_ptr = std::shared_ptr<language>;
@@ -31,8 +58,54 @@ using language_ptr = std::shared_ptr<language>;
 grammar_ptr build_grammar(language const& language);
 
 finite_automaton build_lexer(language const& language);
+/* uses (nthreads) threads for the final NFA to DFA conversion,
+   which dominates for languages with many tokens */
+finite_automaton build_lexer(language const& language, int nthreads);
+/* the lexer before determinization: the union of the Thompson NFAs of
+   all the tokens. lazy_dfa(build_lexer_nfa(language)) tokenizes with
+   the same rules as build_lexer without building the whole DFA,
+   for languages whose lexer DFA would be too large */
+sparse_nfa build_lexer_nfa(language const& language);
+
+/* what build_lexer computed last time, so the lexer of a language
+   whose tokens change can be rebuilt cheaply: the DFA of every regex
+   seen so far, and the last lexer with the tokens it was built from.
+   When the new tokens only append to those, the old lexer is extended
+   by a product construction with the new token DFAs. Otherwise it is
+   rebuilt from the cached token DFAs, and only regexes not seen
+   before are compiled. */
+struct lexer_cache {
+  bool uses_byte_alphabet = false;
+  std::map<std::string, finite_automaton> regex_dfas;
+  std::vector<language::token> tokens;
+  finite_automaton lexer;
+};
+
+finite_automaton build_lexer(language const& language, lexer_cache& cache);
+
+/* if (minimize) is set, equivalent LR states are merged (see
+   minimize_states), which takes longer and only pays off for grammars
+   whose LALR(1) machine has redundant states.
+   (method) only changes how long the tables take to build */
+parser_tables_ptr build_parser_tables(language const& language,
+    bool minimize = false, lalr1_method method = lalr1_method::lane_tracing);
+
+/* same as above, but the lexer states are renumbered so that the
+   states most visited while tokenizing the training corpus are
+   stored contiguously (see reorder_by_profile) */
+parser_tables_ptr build_parser_tables(language const& language,
+    std::vector<std::string> const& lexer_training_corpus);
+
+/* like build_parser_tables(language), but the parser tables are
+   built as they are used (see build_lazy_lr1_tables) */
+parser_tables_ptr build_lazy_parser_tables(language const& language);
 
-parser_tables_ptr build_parser_tables(language const& language);
+/* like build_parser_tables(language), but the lexer DFA is not
+   built: each parser determinizes build_lexer_nfa(language) as it
+   reads, keeping at most about (max_cached_states) DFA states, for
+   languages whose lexer DFA would be too large to build */
+parser_tables_ptr build_parser_tables_with_lazy_lexer(
+    language const& language, int max_cached_states = 10000);
 
 std::ostream& operator<<(std::ostream& os, language const& lang);
 
@@ -161,55 +161,105 @@ void parser::at_token(std::istream& stream) {
      because they don't consume the token */
   while (!done) {
     auto parser_action = get_action(syntax_tables, parser_state, lexer_token);
-    if (parser_action.kind == action::kind::none) {
-      handle_unacceptable_token(stream);
-    } else if (parser_action.kind == action::kind::shift) {
-      std::any shift_result;
-      try {
-        shift_result = this->shift(lexer_token, lexer_text);
-      } catch (error& e) {
-        handle_shift_exception(stream, e);
-      }
-      value_stack.emplace_back(std::move(shift_result));
-      stream_ends_stack.push_back(last_lexer_accept_position);
-      symbol_stack.push_back(lexer_token);
-      done = true;
-    } else if (parser_action.kind == action::kind::reduce) {
-      if (parser_action.production == get_accept_production(*grammar)) {
-        did_accept = true;
-        return;
-      }
-      auto& prod = at(grammar->productions, parser_action.production);
-      reduction_rhs.clear();
-      for (int i = 0; i < isize(prod.rhs); ++i) {
-        reduction_rhs.emplace_back(
-            std::move(at(value_stack, isize(value_stack) - isize(prod.rhs) + i)));
+    switch (parser_action.kind) {
+      case action::kind::none:
+        handle_unacceptable_token(stream);
+        break;
+      case action::kind::shift: {
+        std::any shift_result;
+        try {
+          shift_result = this->shift(lexer_token, lexer_text);
+        } catch (error& e) {
+          handle_shift_exception(stream, e);
+        }
+        value_stack.emplace_back(std::move(shift_result));
+        stream_ends_stack.push_back(last_lexer_accept_position);
+        symbol_stack.push_back(lexer_token);
+        done = true;
+        break;
       }
-      std::any reduce_result;
-      try {
-        reduce_result =
-            this->reduce(parser_action.production, reduction_rhs);
-      } catch (error& e) {
-        handle_reduce_exception(stream, e, prod);
+      case action::kind::reduce: {
+        if (parser_action.production == get_accept_production(*grammar)) {
+          did_accept = true;
+          return;
+        }
+        apply_reduction(stream, parser_action.production);
+        parser_state = execute_action(syntax_tables, parser_stack, parser_action);
+        /* the unit reductions that follow, if precomputed */
+        auto const below = at(parser_stack, isize(parser_stack) - 2);
+        auto const chain = get_reduce_chain(syntax_tables, below,
+            as_nonterminal(*grammar, symbol_stack.back()), lexer_token);
+        if (chain == -1) continue;
+        auto const& chains = syntax_tables.chains;
+        for (int i = at(chains.offsets, chain);
+             i < at(chains.offsets, chain + 1); ++i) {
+          apply_reduction(stream, at(chains.productions, i));
+        }
+        parser_state = parser_stack.back() = at(chains.last_states, chain);
+        continue;
       }
-      resize(value_stack, isize(value_stack) - isize(prod.rhs));
-      value_stack.emplace_back(std::move(reduce_result));
-      auto const old_end = stream_ends_stack.back();
-      resize(stream_ends_stack, isize(stream_ends_stack) - isize(prod.rhs));
-      stream_ends_stack.push_back(old_end);
-      resize(symbol_stack, isize(symbol_stack) - isize(prod.rhs));
-      symbol_stack.push_back(prod.lhs);
-    } else if (parser_action.kind == action::kind::skip) {
-      stream_ends_stack.back() = last_lexer_accept_position;
-      done = true;
-    } else {
-      throw std::logic_error(
-          "serious bug in parsegen::parser: action::kind enum value out of range\n");
+      case action::kind::skip:
+        stream_ends_stack.back() = last_lexer_accept_position;
+        done = true;
+        break;
+      default:
+        throw std::logic_error(
+            "serious bug in parsegen::parser: action::kind enum value out of range\n");
     }
     parser_state = execute_action(syntax_tables, parser_stack, parser_action);
   }
 }
 
+static std::any make_builtin_value(
+    builtin_reduction builtin, std::vector<std::any>& rhs) {
+  switch (builtin) {
+    case builtin_reduction::empty_list:
+      return std::vector<std::any>();
+    case builtin_reduction::first_item: {
+      std::vector<std::any> list;
+      list.emplace_back(std::move(at(rhs, 0)));
+      return list;
+    }
+    case builtin_reduction::next_item:
+      std::any_cast<std::vector<std::any>&>(at(rhs, 0))
+          .emplace_back(std::move(at(rhs, 1)));
+      return std::move(at(rhs, 0));
+    case builtin_reduction::absent:
+      return std::any();
+    case builtin_reduction::present:
+      return std::move(at(rhs, 0));
+    default:
+      throw std::logic_error(
+          "serious bug in parsegen::parser: builtin_reduction enum value out of range\n");
+  }
+}
+
+void parser::apply_reduction(std::istream& stream, int production) {
+  auto& prod = at(grammar->productions, production);
+  reduction_rhs.clear();
+  for (int i = 0; i < isize(prod.rhs); ++i) {
+    reduction_rhs.emplace_back(
+        std::move(at(value_stack, isize(value_stack) - isize(prod.rhs) + i)));
+  }
+  std::any reduce_result;
+  if (prod.builtin != builtin_reduction::none) {
+    reduce_result = make_builtin_value(prod.builtin, reduction_rhs);
+  } else {
+    try {
+      reduce_result = this->reduce(production, reduction_rhs);
+    } catch (error& e) {
+      handle_reduce_exception(stream, e, prod);
+    }
+  }
+  resize(value_stack, isize(value_stack) - isize(prod.rhs));
+  value_stack.emplace_back(std::move(reduce_result));
+  auto const old_end = stream_ends_stack.back();
+  resize(stream_ends_stack, isize(stream_ends_stack) - isize(prod.rhs));
+  stream_ends_stack.push_back(old_end);
+  resize(symbol_stack, isize(symbol_stack) - isize(prod.rhs));
+  symbol_stack.push_back(prod.lhs);
+}
+
 void parser::handle_indent_mismatch(std::istream& stream) {
   std::stringstream ss;
   int line, column;
@@ -269,7 +319,7 @@ void parser::backtrack_to_last_accept(std::istream& stream) {
 }
 
 void parser::reset_lexer_state() {
-  lexer_state = 0;
+  lexer_state = lazy_lexer ? lazy_lexer->get_start_state() : 0;
   lexer_text.clear();
   lexer_token = -1;
 }
@@ -314,16 +364,49 @@ parser::parser(parser_tables_ptr tables_in)
       lexical_tables(tables->lexical_tables),
       grammar(get_grammar(syntax_tables))
 {
-  if (!get_determinism(lexical_tables)) {
+  if (tables->lexer_nfa) {
+    lazy_lexer = std::make_unique<lazy_dfa>(
+        *(tables->lexer_nfa), tables->lexer_max_cached_states);
+  } else if (!get_determinism(lexical_tables)) {
     throw std::logic_error("parsegen::parser: the lexer in the given tables is not a deterministic finite automaton");
   }
 }
 
+parser::parser(parser const& other)
+    : tables(other.tables),
+      syntax_tables(tables->syntax_tables),
+      lexical_tables(tables->lexical_tables),
+      grammar(other.grammar),
+      position(other.position),
+      lexer_state(other.lexer_state),
+      lexer_text(other.lexer_text),
+      lexer_token(other.lexer_token),
+      last_lexer_accept(other.last_lexer_accept),
+      last_lexer_accept_position(other.last_lexer_accept_position),
+      parser_state(other.parser_state),
+      parser_stack(other.parser_stack),
+      value_stack(other.value_stack),
+      reduction_rhs(other.reduction_rhs),
+      stream_ends_stack(other.stream_ends_stack),
+      symbol_stack(other.symbol_stack),
+      stream_name(other.stream_name),
+      did_accept(other.did_accept),
+      sensing_indent(other.sensing_indent),
+      indent_text(other.indent_text),
+      indent_stack(other.indent_stack)
+{
+  /* the states of a lazy_dfa are renumbered when its cache is flushed,
+     so copies cannot share one */
+  if (other.lazy_lexer) {
+    lazy_lexer = std::make_unique<lazy_dfa>(
+        *(tables->lexer_nfa), tables->lexer_max_cached_states);
+    lexer_state = lazy_lexer->get_start_state();
+  }
+}
+
 std::any parser::parse_stream(
     std::istream& stream, std::string const& stream_name_in) {
-  lexer_state = 0;
-  lexer_text.clear();
-  lexer_token = -1;
+  reset_lexer_state();
   parser_state = 0;
   parser_stack.clear();
   parser_stack.push_back(parser_state);
@@ -340,19 +423,23 @@ std::any parser::parse_stream(
   } else {
     sensing_indent = false;
   }
+  auto const nsymbols = lazy_lexer ? lazy_lexer->get_nsymbols()
+                                   : get_nsymbols(lexical_tables);
   char c;
   while (stream.get(c)) {
-    if (!is_symbol(c)) {
+    if (!is_symbol(c, nsymbols)) {
       handle_bad_character(stream, c);
     }
     position = stream.tellg();
     lexer_text.push_back(c);
     auto lexer_symbol = get_symbol(c);
-    lexer_state = step(lexical_tables, lexer_state, lexer_symbol);
+    lexer_state = lazy_lexer ? lazy_lexer->step(lexer_state, lexer_symbol)
+                             : step(lexical_tables, lexer_state, lexer_symbol);
     if (lexer_state == -1) {
       at_lexer_end(stream);
     } else {
-      auto token = accepts(lexical_tables, lexer_state);
+      auto token = lazy_lexer ? lazy_lexer->accepts(lexer_state)
+                              : accepts(lexical_tables, lexer_state);
       if (token != -1) {
         lexer_token = token;
         last_lexer_accept = lexer_text.size();
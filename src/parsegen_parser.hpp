@@ -17,7 +17,9 @@ using stream_position = std::istream::pos_type;
 class parser {
  public:
   parser() = delete;
-  parser(parser const&) = default;
+  /* a copy of a parser with a lazy lexer gets its own, empty lazy_dfa,
+     so it can only be used for a new parse */
+  parser(parser const& other);
   virtual ~parser() = default;
   parser(parser_tables_ptr tables_in);
   std::any parse_stream(
@@ -37,6 +39,8 @@ class parser {
   parser_tables_ptr tables;
   shift_reduce_tables const& syntax_tables;
   finite_automaton const& lexical_tables;
+  /* used instead of lexical_tables if the tables have a lexer NFA */
+  std::unique_ptr<lazy_dfa> lazy_lexer;
   grammar_ptr grammar;
   stream_position position;
   int lexer_state;
@@ -68,6 +72,7 @@ class parser {
  private:  // helper methods
   void at_token(std::istream& stream);
   void at_token_indent(std::istream& stream);
+  void apply_reduction(std::istream& stream, int production);
   void at_lexer_end(std::istream& stream);
   void backtrack_to_last_accept(std::istream& stream);
   void reset_lexer_state();
@@ -40,4 +40,71 @@ std::ostream& operator<<(std::ostream& os, parser_graph const& g) {
   return os;
 }
 
+csr_graph make_csr_graph(int nnodes, edge_list const& edges) {
+  csr_graph out;
+  out.offsets.assign(std::size_t(nnodes + 1), 0);
+  for (auto& edge : edges) ++at(out.offsets, edge.first + 1);
+  for (int i = 0; i < nnodes; ++i) {
+    at(out.offsets, i + 1) += at(out.offsets, i);
+  }
+  resize(out.edges, isize(edges));
+  auto fill = out.offsets;
+  for (auto& edge : edges) at(out.edges, at(fill, edge.first)++) = edge.second;
+  return out;
+}
+
+csr_graph make_csr_graph(parser_graph const& g) {
+  csr_graph out;
+  auto nnodes = get_nnodes(g);
+  reserve(out.offsets, nnodes + 1);
+  out.offsets.push_back(0);
+  for (int i = 0; i < nnodes; ++i) {
+    auto& node_edges = get_edges(g, i);
+    out.edges.insert(out.edges.end(), node_edges.begin(), node_edges.end());
+    out.offsets.push_back(isize(out.edges));
+  }
+  return out;
+}
+
+int get_nnodes(csr_graph const& g) { return isize(g.offsets) - 1; }
+
+csr_edges get_edges(csr_graph const& g, int i) {
+  auto data = g.edges.data();
+  return {data + at(g.offsets, i), data + at(g.offsets, i + 1)};
+}
+
+/* one pass counts the in-degree of each node, and a second one places
+   the edges. Sources are visited in increasing order, so the edges of
+   each node of the transpose are sorted */
+csr_graph make_transpose(csr_graph const& g) {
+  auto nnodes = get_nnodes(g);
+  csr_graph out;
+  out.offsets.assign(std::size_t(nnodes + 1), 0);
+  for (auto j : g.edges) ++at(out.offsets, j + 1);
+  for (int i = 0; i < nnodes; ++i) {
+    at(out.offsets, i + 1) += at(out.offsets, i);
+  }
+  resize(out.edges, isize(g.edges));
+  auto fill = out.offsets;
+  for (int i = 0; i < nnodes; ++i) {
+    for (auto j : get_edges(g, i)) at(out.edges, at(fill, j)++) = i;
+  }
+  return out;
+}
+
+int at(csr_graph const& g, int i, int j) {
+  assert(0 <= j);
+  assert(j < get_edges(g, i).size());
+  return at(g.edges, at(g.offsets, i) + j);
+}
+
+std::ostream& operator<<(std::ostream& os, csr_graph const& g) {
+  for (int i = 0; i < get_nnodes(g); ++i) {
+    os << i << ":";
+    for (auto j : get_edges(g, i)) os << " " << j;
+    os << '\n';
+  }
+  return os;
+}
+
 }  // namespace parsegen
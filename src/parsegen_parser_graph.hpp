@@ -2,6 +2,7 @@
 #define PARSEGEN_GRAPH_HPP
 
 #include <iosfwd>
+#include <utility>
 #include <vector>
 
 namespace parsegen {
@@ -18,6 +19,37 @@ parser_graph make_transpose(parser_graph const& g);
 int at(parser_graph const& g, int i, int j);
 std::ostream& operator<<(std::ostream& os, parser_graph const& g);
 
+/* an immutable graph in compressed sparse row form, for graphs that
+   are only read once built: the edges of node i are
+   edges[offsets[i]] through edges[offsets[i + 1] - 1], so the whole
+   graph is two allocations and traversals are sequential. */
+struct csr_graph {
+  std::vector<int> offsets;
+  std::vector<int> edges;
+};
+
+struct csr_edges {
+  int const* first;
+  int const* last;
+  int const* begin() const { return first; }
+  int const* end() const { return last; }
+  int size() const { return int(last - first); }
+  bool empty() const { return first == last; }
+  int front() const { return *first; }
+  int operator[](int i) const { return first[i]; }
+};
+
+using edge_list = std::vector<std::pair<int, int>>;
+
+/* the edges of each node keep their order in (edges) */
+csr_graph make_csr_graph(int nnodes, edge_list const& edges);
+csr_graph make_csr_graph(parser_graph const& g);
+int get_nnodes(csr_graph const& g);
+csr_edges get_edges(csr_graph const& g, int i);
+csr_graph make_transpose(csr_graph const& g);
+int at(csr_graph const& g, int i, int j);
+std::ostream& operator<<(std::ostream& os, csr_graph const& g);
+
 }  // namespace parsegen
 
 #endif
@@ -18,6 +18,11 @@ struct parser_tables {
   shift_reduce_tables syntax_tables;
   finite_automaton lexical_tables;
   indentation indent_info;
+  /* if set, lexical_tables is empty and each parser tokenizes with its
+     own lazy_dfa of this NFA, keeping at most about
+     lexer_max_cached_states of its states */
+  std::shared_ptr<sparse_nfa const> lexer_nfa;
+  int lexer_max_cached_states = 0;
 };
 
 using parser_tables_ptr = std::shared_ptr<parser_tables const>;
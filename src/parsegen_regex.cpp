@@ -84,17 +84,19 @@ finite_automaton build_lexer() {
   auto lex_slash = make_char_single_nfa('\\');
   auto lex_any = finite_automaton::make_set_nfa(NCHARS, all_chars);
   auto lex_escaped = finite_automaton::concat(lex_slash, lex_any, TOK_CHAR);
-  auto lex_char = finite_automaton::unite(lex_nonmeta, lex_escaped);
-  finite_automaton lex_metachars;
+  sparse_nfa out(NCHARS, 0);
+  add_state(out);
+  auto add_token = [&](finite_automaton const& token_nfa) {
+    auto offset = get_nstates(out);
+    append_states(out, token_nfa);
+    add_transition(out, 0, get_epsilon(out), offset);
+  };
+  add_token(lex_nonmeta);
+  add_token(lex_escaped);
   for (int i = 0; i < isize(meta_chars_str); ++i) {
     int token = TOK_CHAR + i + 1;
-    auto lex_metachar = make_char_single_nfa(at(meta_chars_str, i), token);
-    if (i)
-      lex_metachars = finite_automaton::unite(lex_metachars, lex_metachar);
-    else
-      lex_metachars = lex_metachar;
+    add_token(make_char_single_nfa(at(meta_chars_str, i), token));
   }
-  auto out = finite_automaton::unite(lex_char, lex_metachars);
   return finite_automaton::simplify(finite_automaton::make_deterministic(out));
 }
 
@@ -111,12 +113,14 @@ parser_tables_ptr ask_parser_tables() {
     auto lang = regex::ask_language();
     auto grammar = build_grammar(*lang);
     auto parser = accept_parser(build_lalr1_parser(grammar));
+    add_reduce_chains(parser);
+    compress_if_sparse(parser);
     auto lexer = regex::build_lexer();
     indentation indent_info;
     indent_info.is_sensitive = false;
     indent_info.indent_token = -1;
     indent_info.dedent_token = -1;
-    ptr.reset(new parser_tables{parser, lexer, indent_info});
+    ptr.reset(new parser_tables{parser, lexer, indent_info, nullptr, 0});
   }
   return ptr;
 }
@@ -138,9 +142,20 @@ language_ptr ask_language() {
 
 finite_automaton build_dfa(
     std::string const& name, std::string const& regex, int token) {
-  auto parser = regex::parser(token);
+  return build_dfa(name, regex, token, NCHARS);
+}
+
+finite_automaton build_dfa(std::string const& name, std::string const& regex,
+    int token, int nsymbols) {
+  return finite_automaton::simplify(finite_automaton::make_deterministic(
+      build_nfa(name, regex, token, nsymbols)));
+}
+
+sparse_nfa build_nfa(std::string const& name, std::string const& regex,
+    int token, int nsymbols) {
+  auto parser = regex::parser(token, nsymbols);
   try {
-    return std::any_cast<finite_automaton>(parser.parse_string(regex, name));
+    return std::any_cast<sparse_nfa>(parser.parse_string(regex, name));
   } catch (const parse_error& e) {
     std::stringstream ss;
     ss << e.what() << '\n';
@@ -154,8 +169,96 @@ finite_automaton build_dfa(
 }
 
 regex::parser::parser(int result_token_in)
+    : regex::parser(result_token_in, NCHARS) {}
+
+regex::parser::parser(int result_token_in, int nsymbols_in)
     : parsegen::parser(regex::ask_parser_tables()),
-      result_token(result_token_in) {}
+      result_token(result_token_in),
+      nsymbols(nsymbols_in) {
+  reset_nfa();
+}
+
+/* Thompson's construction, done in place:
+
+   Thompson, Ken.
+   "Programming techniques: Regular expression search algorithm."
+   Communications of the ACM 11.6 (1968): 419-422.
+
+   Every sub-expression is a fragment of one shared NFA with a single
+   start state and a single end state that has no outgoing transitions
+   yet. Each reduction adds at most two states and a few epsilon
+   transitions, so a regex compiles in time linear in its length
+   instead of copying both operands at each step.
+   State 0 is reserved as the entry and is linked to the start of the
+   final fragment. */
+namespace {
+
+struct nfa_fragment {
+  int start;
+  int end;
+};
+
+}  // end anonymous namespace
+
+void regex::parser::reset_nfa() {
+  nfa = sparse_nfa(nsymbols, 0);
+  add_state(nfa);
+}
+
+static nfa_fragment make_set_fragment(
+    sparse_nfa& nfa, std::set<int> const& symbols) {
+  nfa_fragment out;
+  out.start = add_state(nfa);
+  out.end = add_state(nfa);
+  for (auto symbol : symbols) add_transition(nfa, out.start, symbol, out.end);
+  return out;
+}
+
+static nfa_fragment concat_fragments(
+    sparse_nfa& nfa, nfa_fragment const& a, nfa_fragment const& b) {
+  add_transition(nfa, a.end, get_epsilon(nfa), b.start);
+  return {a.start, b.end};
+}
+
+static nfa_fragment unite_fragments(
+    sparse_nfa& nfa, nfa_fragment const& a, nfa_fragment const& b) {
+  nfa_fragment out;
+  out.start = add_state(nfa);
+  out.end = add_state(nfa);
+  add_transition(nfa, out.start, get_epsilon(nfa), a.start);
+  add_transition(nfa, out.start, get_epsilon(nfa), b.start);
+  add_transition(nfa, a.end, get_epsilon(nfa), out.end);
+  add_transition(nfa, b.end, get_epsilon(nfa), out.end);
+  return out;
+}
+
+static nfa_fragment plus_fragment(sparse_nfa& nfa, nfa_fragment const& a) {
+  auto end = add_state(nfa);
+  add_transition(nfa, a.end, get_epsilon(nfa), a.start);
+  add_transition(nfa, a.end, get_epsilon(nfa), end);
+  return {a.start, end};
+}
+
+static nfa_fragment maybe_fragment(
+    sparse_nfa& nfa, nfa_fragment const& a) {
+  nfa_fragment out;
+  out.start = add_state(nfa);
+  out.end = add_state(nfa);
+  add_transition(nfa, out.start, get_epsilon(nfa), a.start);
+  add_transition(nfa, out.start, get_epsilon(nfa), out.end);
+  add_transition(nfa, a.end, get_epsilon(nfa), out.end);
+  return out;
+}
+
+static nfa_fragment star_fragment(sparse_nfa& nfa, nfa_fragment const& a) {
+  return maybe_fragment(nfa, plus_fragment(nfa, a));
+}
+
+static std::set<int> get_symbols(std::set<char> const& chars) {
+  std::set<int> out;
+  for (auto c : chars) out.insert(get_symbol(c));
+  return out;
+}
 
 std::any regex::parser::shift(int token, std::string& text) {
   if (token != TOK_CHAR) {
@@ -174,9 +277,14 @@ std::any regex::parser::shift(int token, std::string& text) {
 
 std::any regex::parser::reduce(int production, std::vector<std::any>& rhs) {
   switch (production) {
-    case PROD_REGEX:
-      return finite_automaton::simplify(finite_automaton::make_deterministic(
-          std::any_cast<finite_automaton&&>(std::move(at(rhs, 0)))));
+    case PROD_REGEX: {
+      auto a = std::any_cast<nfa_fragment>(at(rhs, 0));
+      add_transition(nfa, 0, get_epsilon(nfa), a.start);
+      add_accept(nfa, a.end, result_token);
+      auto result = std::move(nfa);
+      reset_nfa();
+      return result;
+    }
     case PROD_UNION_DECAY:
     case PROD_CONCAT_DECAY:
     case PROD_QUAL_DECAY:
@@ -184,38 +292,39 @@ std::any regex::parser::reduce(int production, std::vector<std::any>& rhs) {
     case PROD_SET_ITEM_RANGE:
       return at(rhs, 0);
     case PROD_UNION:
-      return finite_automaton::unite(std::any_cast<finite_automaton&&>(std::move(at(rhs, 0))),
-          std::any_cast<finite_automaton&&>(std::move(at(rhs, 2))));
-    case PROD_CONCAT: {
-      auto& a_any = at(rhs, 0);
-      auto& b_any = at(rhs, 1);
-      auto a = std::any_cast<finite_automaton&&>(std::move(a_any));
-      auto b = std::any_cast<finite_automaton&&>(std::move(b_any));
-      return finite_automaton::concat(a, b, result_token);
-    }
+      return unite_fragments(nfa, std::any_cast<nfa_fragment>(at(rhs, 0)),
+          std::any_cast<nfa_fragment>(at(rhs, 2)));
+    case PROD_CONCAT:
+      return concat_fragments(nfa, std::any_cast<nfa_fragment>(at(rhs, 0)),
+          std::any_cast<nfa_fragment>(at(rhs, 1)));
     case PROD_STAR:
-      return finite_automaton::star(
-          std::any_cast<finite_automaton&&>(std::move(at(rhs, 0))), result_token);
+      return star_fragment(nfa, std::any_cast<nfa_fragment>(at(rhs, 0)));
     case PROD_PLUS:
-      return finite_automaton::plus(
-          std::any_cast<finite_automaton&&>(std::move(at(rhs, 0))), result_token);
+      return plus_fragment(nfa, std::any_cast<nfa_fragment>(at(rhs, 0)));
     case PROD_MAYBE:
-      return finite_automaton::maybe(
-          std::any_cast<finite_automaton&&>(std::move(at(rhs, 0))), result_token);
-    case PROD_SINGLE_CHAR:
-      return make_char_single_nfa(std::any_cast<char>(at(rhs, 0)), result_token);
-    case PROD_ANY:
-      return finite_automaton::make_range_nfa(
-          NCHARS, 0, NCHARS - 1, result_token);
+      return maybe_fragment(nfa, std::any_cast<nfa_fragment>(at(rhs, 0)));
+    case PROD_SINGLE_CHAR: {
+      auto c = std::any_cast<char>(at(rhs, 0));
+      assert(is_symbol(c, nsymbols));
+      return make_set_fragment(nfa, {get_symbol(c)});
+    }
+    case PROD_ANY: {
+      std::set<int> all_symbols;
+      for (int symbol = 0; symbol < nsymbols; ++symbol) {
+        all_symbols.insert(symbol);
+      }
+      return make_set_fragment(nfa, all_symbols);
+    }
     case PROD_SINGLE_SET:
-      return make_char_set_nfa(
-          std::any_cast<std::set<char>&&>(std::move(at(rhs, 0))), result_token);
+      return make_set_fragment(nfa,
+          get_symbols(std::any_cast<std::set<char> const&>(at(rhs, 0))));
     case PROD_PARENS_UNION:
       return at(rhs, 1);
     case PROD_SET_POSITIVE:
       return at(rhs, 0);
     case PROD_SET_NEGATIVE:
-      return negate_set(std::any_cast<std::set<char>&&>(std::move(at(rhs, 0))));
+      return negate_set(
+          std::any_cast<std::set<char>&&>(std::move(at(rhs, 0))), nsymbols);
     case PROD_POSITIVE_SET:
       return at(rhs, 1);
     case PROD_NEGATIVE_SET:
@@ -257,7 +366,9 @@ void remove_range(std::set<char>& s, char first, char last)
 
 bool matches(std::string const& r, std::string const& t)
 {
-  return accepts(build_dfa("first arg of matches", r, 0), t, 0);
+  /* only the DFA states that t reaches are ever built */
+  lazy_dfa dfa(build_nfa("first arg of matches", r, 0, NCHARS));
+  return accepts(dfa, t, 0);
 }
 
 std::string internal_from_charset(std::set<char> s)
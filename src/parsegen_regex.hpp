@@ -62,6 +62,10 @@ parser_tables_ptr ask_parser_tables();
 
 finite_automaton build_dfa(
     std::string const& name, std::string const& regex, int token);
+finite_automaton build_dfa(std::string const& name, std::string const& regex,
+    int token, int nsymbols);
+sparse_nfa build_nfa(std::string const& name, std::string const& regex,
+    int token, int nsymbols);
 
 std::any shift_internal(int token, std::string& text);
 std::any reduce_internal(int production, std::vector<std::any>& rhs, int result_token);
@@ -69,6 +73,7 @@ std::any reduce_internal(int production, std::vector<std::any>& rhs, int result_
 class parser : public parsegen::parser {
  public:
   parser(int result_token_in);
+  parser(int result_token_in, int nsymbols_in);
   parser(parser const&) = default;
   virtual ~parser() override = default;
 
@@ -77,7 +82,11 @@ class parser : public parsegen::parser {
   virtual std::any reduce(int token, std::vector<std::any>& rhs) override;
 
  private:
+  void reset_nfa();
   int result_token;
+  int nsymbols;
+  /* the NFA that all fragments of the regex are built into */
+  sparse_nfa nfa;
 };
 
 bool matches(std::string const& r, std::string const& t);
@@ -1,22 +1,45 @@
 #include "parsegen_shift_reduce_tables.hpp"
 
+#include <algorithm>
+#include <map>
+
 namespace parsegen {
 
+static bool is_compressed(shift_reduce_tables const& p) {
+  return !p.terminal_rows.offsets.empty();
+}
+
+template <typename T>
+static std::size_t get_nbytes(displaced_table<T> const& t) {
+  return (size(t.entries) + size(t.defaults)) * sizeof(T) +
+         (size(t.checks) + size(t.offsets)) * sizeof(int);
+}
+
+static std::size_t get_nbytes(shift_reduce_tables const& p) {
+  return size(p.terminal_table.data) * sizeof(packed_action) +
+         size(p.nonterminal_table.data) * sizeof(int) +
+         get_nbytes(p.terminal_rows) + get_nbytes(p.nonterminal_columns);
+}
+
 shift_reduce_tables::shift_reduce_tables(grammar_ptr g, int nstates_reserve)
     : grammar(g),
       terminal_table(g->nterminals, nstates_reserve),
       nonterminal_table(get_nnonterminals(*g), nstates_reserve) {}
 
-int get_nstates(shift_reduce_tables const& p) { return get_nrows(p.terminal_table); }
+int get_nstates(shift_reduce_tables const& p) {
+  if (p.lazy) return p.lazy->get_nstates();
+  if (is_compressed(p)) return isize(p.terminal_rows.offsets);
+  return get_nrows(p.terminal_table);
+}
 
 int add_state(shift_reduce_tables& p) {
   auto state = get_nstates(p);
   resize(p.terminal_table, state + 1, get_ncols(p.terminal_table));
   resize(p.nonterminal_table, state + 1, get_ncols(p.nonterminal_table));
+  action none;
+  none.kind = action::kind::none;
   for (int t = 0; t < p.grammar->nterminals; ++t) {
-    action action;
-    action.kind = action::kind::none;
-    at(p.terminal_table, state, t) = action;
+    at(p.terminal_table, state, t) = pack_action(none);
   }
   for (int nt = 0; nt < get_nnonterminals(*(p.grammar)); ++nt) {
     at(p.nonterminal_table, state, nt) = -1;
@@ -25,7 +48,8 @@ int add_state(shift_reduce_tables& p) {
 }
 
 void add_terminal_action(shift_reduce_tables& p, int state, int terminal, action action) {
-  assert(at(p.terminal_table, state, terminal).kind == action::kind::none);
+  assert(unpack_action(at(p.terminal_table, state, terminal)).kind ==
+         action::kind::none);
   assert(action.kind != action::kind::none);
   if (action.kind == action::kind::shift) {
     assert(0 <= action.next_state);
@@ -34,7 +58,7 @@ void add_terminal_action(shift_reduce_tables& p, int state, int terminal, action
     assert(0 <= action.production);
     assert(action.production < isize(p.grammar->productions));
   }
-  at(p.terminal_table, state, terminal) = action;
+  at(p.terminal_table, state, terminal) = pack_action(action);
 }
 
 void add_nonterminal_action(
@@ -45,29 +69,312 @@ void add_nonterminal_action(
   at(p.nonterminal_table, state, nonterminal) = next_state;
 }
 
-action const& get_action(shift_reduce_tables const& p, int state, int terminal) {
-  return at(p.terminal_table, state, terminal);
+action get_action(shift_reduce_tables const& p, int state, int terminal) {
+  if (p.lazy) return p.lazy->get_action(state, terminal);
+  if (is_compressed(p)) {
+    return unpack_action(at(p.terminal_rows, state, terminal));
+  }
+  return unpack_action(at(p.terminal_table, state, terminal));
 }
 
 int execute_action(
     shift_reduce_tables const& p, std::vector<int>& stack, action const& action) {
-  assert(action.kind != action::kind::none);
-  if (action.kind == action::kind::shift) {
-    stack.push_back(action.next_state);
-  } else if (action.kind == action::kind::reduce) {
-    auto& prod = at(p.grammar->productions, action.production);
-    resize(stack, isize(stack) - isize(prod.rhs));
-    assert(p.grammar.get());
-    auto& grammar = *(p.grammar);
-    auto nt = as_nonterminal(grammar, prod.lhs);
-    assert(!stack.empty());
-    auto next_state = at(p.nonterminal_table, stack.back(), nt);
-    stack.push_back(next_state);
-  } else if (action.kind == action::kind::skip) {
+  switch (action.kind) {
+    case action::kind::shift:
+      stack.push_back(action.next_state);
+      break;
+    case action::kind::reduce: {
+      auto& prod = at(p.grammar->productions, action.production);
+      resize(stack, isize(stack) - isize(prod.rhs));
+      assert(p.grammar.get());
+      auto& grammar = *(p.grammar);
+      auto nt = as_nonterminal(grammar, prod.lhs);
+      assert(!stack.empty());
+      auto next_state = get_next_state(p, stack.back(), nt);
+      stack.push_back(next_state);
+      break;
+    }
+    case action::kind::skip:
+      break;
+    case action::kind::none:
+      assert(false);
+      break;
   }
   return stack.back();
 }
 
+int get_next_state(shift_reduce_tables const& p, int state, int nonterminal) {
+  if (p.lazy) return p.lazy->get_next_state(state, nonterminal);
+  if (is_compressed(p)) return at(p.nonterminal_columns, nonterminal, state);
+  return at(p.nonterminal_table, state, nonterminal);
+}
+
 grammar_ptr const& get_grammar(shift_reduce_tables const& p) { return p.grammar; }
 
+/* each state's row keeps its most common action as its default, so
+   rows that reduce on most lookaheads are short too. The terminal
+   rows stay exact, while a nonterminal's column only keeps the states
+   whose next state is not the default, since the others are never
+   asked for. */
+void compress_if_sparse(shift_reduce_tables& p) {
+  if (p.lazy || is_compressed(p)) return;
+  auto nstates = get_nstates(p);
+  auto nterminals = get_ncols(p.terminal_table);
+  auto nnonterminals = get_ncols(p.nonterminal_table);
+  if (nstates == 0) return;
+  auto rows = make_vector<std::vector<std::pair<int, packed_action>>>(nstates);
+  std::vector<packed_action> row_defaults;
+  std::vector<std::pair<int, packed_action>> counts;
+  for (int state = 0; state < nstates; ++state) {
+    counts.clear();
+    for (int t = 0; t < nterminals; ++t) {
+      auto action = at(p.terminal_table, state, t);
+      auto it = std::find_if(counts.begin(), counts.end(),
+          [&](std::pair<int, packed_action> const& count) {
+            return count.second == action;
+          });
+      if (it == counts.end()) {
+        counts.push_back(std::make_pair(1, action));
+      } else {
+        ++(it->first);
+      }
+    }
+    auto most_common = std::max_element(counts.begin(), counts.end(),
+        [](std::pair<int, packed_action> const& a,
+            std::pair<int, packed_action> const& b) {
+          return a.first < b.first;
+        });
+    row_defaults.push_back(most_common->second);
+    for (int t = 0; t < nterminals; ++t) {
+      auto action = at(p.terminal_table, state, t);
+      if (action == row_defaults.back()) continue;
+      at(rows, state).push_back(std::make_pair(t, action));
+    }
+  }
+  auto columns = make_vector<std::vector<std::pair<int, int>>>(nnonterminals);
+  std::vector<int> column_defaults;
+  std::map<int, int> next_state_counts;
+  for (int nt = 0; nt < nnonterminals; ++nt) {
+    next_state_counts.clear();
+    for (int state = 0; state < nstates; ++state) {
+      auto next_state = at(p.nonterminal_table, state, nt);
+      if (next_state != -1) ++next_state_counts[next_state];
+    }
+    auto most_common = std::max_element(next_state_counts.begin(),
+        next_state_counts.end(),
+        [](std::pair<int const, int> const& a, std::pair<int const, int> const& b) {
+          return a.second < b.second;
+        });
+    auto column_default =
+        (most_common == next_state_counts.end()) ? -1 : most_common->first;
+    column_defaults.push_back(column_default);
+    for (int state = 0; state < nstates; ++state) {
+      auto next_state = at(p.nonterminal_table, state, nt);
+      if (next_state == -1 || next_state == column_default) continue;
+      at(columns, nt).push_back(std::make_pair(state, next_state));
+    }
+  }
+  auto terminal_rows = make_displaced_table(nterminals, rows, row_defaults);
+  auto nonterminal_columns =
+      make_displaced_table(nstates, columns, column_defaults);
+  auto dense_size = get_nbytes(p);
+  auto compressed_size =
+      get_nbytes(terminal_rows) + get_nbytes(nonterminal_columns);
+  if (2 * compressed_size >= dense_size) return;
+  p.terminal_rows = std::move(terminal_rows);
+  p.nonterminal_columns = std::move(nonterminal_columns);
+  p.terminal_table.data.clear();
+  p.terminal_table.data.shrink_to_fit();
+  p.nonterminal_table.data.clear();
+  p.nonterminal_table.data.shrink_to_fit();
+}
+
+/* a unit reduction on top of (state) leaves the stack one goto from
+   (state) again, so its chain only depends on the gotos of (state) and
+   the rows they lead to. Equal chains are stored once, and most of
+   the lookaheads of a goto share one chain or none. */
+void add_reduce_chains(shift_reduce_tables& p) {
+  assert(!p.lazy && !is_compressed(p));
+  auto& grammar = *(p.grammar);
+  auto nstates = get_nstates(p);
+  auto nterminals = grammar.nterminals;
+  auto nnonterminals = get_nnonterminals(grammar);
+  auto accept_production = get_accept_production(grammar);
+  auto max_nbytes = std::size_t(nstates) *
+                    std::size_t(nterminals + nnonterminals) * sizeof(int);
+  std::size_t nbytes = 0;
+  reduce_chains out;
+  out.offsets.push_back(0);
+  auto goto_rows = make_vector<std::vector<std::pair<int, int>>>(nstates);
+  std::vector<std::vector<std::pair<int, int>>> rows;
+  std::vector<int> row_defaults;
+  std::map<std::vector<int>, int> chain_ids;
+  std::vector<int> chain;
+  std::vector<int> row_chains;
+  std::map<int, int> chain_counts;
+  for (int state = 0; state < nstates; ++state) {
+    for (int nt = 0; nt < nnonterminals; ++nt) {
+      auto goto_state = get_next_state(p, state, nt);
+      if (goto_state == -1) continue;
+      row_chains.clear();
+      chain_counts.clear();
+      for (int t = 0; t < nterminals; ++t) {
+        chain.clear();
+        auto top = goto_state;
+        while (true) {
+          auto action = get_action(p, top, t);
+          if (action.kind != action::kind::reduce) break;
+          if (action.production == accept_production) break;
+          auto& prod = at(grammar.productions, action.production);
+          if (isize(prod.rhs) != 1) break;
+          chain.push_back(action.production);
+          top = get_next_state(p, state, as_nonterminal(grammar, prod.lhs));
+        }
+        auto chain_id = -1;
+        if (isize(chain) >= 2) {
+          chain.push_back(top);
+          auto res = chain_ids.insert(
+              std::make_pair(chain, int(chain_ids.size())));
+          if (res.second) {
+            out.productions.insert(
+                out.productions.end(), chain.begin(), chain.end() - 1);
+            out.offsets.push_back(isize(out.productions));
+            out.last_states.push_back(top);
+            nbytes += size(chain) * sizeof(int) + sizeof(int);
+          }
+          chain_id = res.first->second;
+        }
+        row_chains.push_back(chain_id);
+        ++chain_counts[chain_id];
+      }
+      auto most_common = std::max_element(chain_counts.begin(),
+          chain_counts.end(),
+          [](std::pair<int const, int> const& a,
+              std::pair<int const, int> const& b) {
+            return a.second < b.second;
+          });
+      if (chain_counts.size() == 1 && most_common->first == -1) continue;
+      at(goto_rows, state).push_back(std::make_pair(nt, isize(rows)));
+      row_defaults.push_back(most_common->first);
+      rows.emplace_back();
+      for (int t = 0; t < nterminals; ++t) {
+        if (at(row_chains, t) == most_common->first) continue;
+        rows.back().push_back(std::make_pair(t, at(row_chains, t)));
+      }
+      /* stop early if the cells alone are too many */
+      nbytes += size(rows.back()) * 2 * sizeof(int);
+      if (nbytes > max_nbytes) return;
+    }
+  }
+  if (rows.empty()) return;
+  out.gotos = make_displaced_table(
+      nnonterminals, goto_rows, make_vector<int>(nstates, -1));
+  out.chain_rows = make_displaced_table(nterminals, rows, row_defaults);
+  nbytes = size(out.offsets) + size(out.productions) + size(out.last_states);
+  nbytes = nbytes * sizeof(int) + get_nbytes(out.gotos) +
+           get_nbytes(out.chain_rows);
+  if (nbytes > max_nbytes) return;
+  p.chains = std::move(out);
+}
+
+int get_reduce_chain(
+    shift_reduce_tables const& p, int state, int nonterminal, int terminal) {
+  if (p.chains.offsets.empty()) return -1;
+  auto row = at(p.chains.gotos, state, nonterminal);
+  if (row == -1) return -1;
+  return at(p.chains.chain_rows, row, terminal);
+}
+
+/* Moore's partition refinement over the rows: all states start in
+   one block, and each round splits the blocks by the actions of their
+   states, with shifts and gotos naming the block of their target, until
+   a round splits nothing. The states of a block then make the same
+   moves on any input, so one of them can stand for all. Blocks are
+   numbered by their first state, which keeps the start state at 0. */
+shift_reduce_tables minimize_states(shift_reduce_tables const& p) {
+  assert(!p.lazy && !is_compressed(p));
+  auto nstates = get_nstates(p);
+  if (nstates == 0) return p;
+  auto nterminals = get_ncols(p.terminal_table);
+  auto nnonterminals = get_ncols(p.nonterminal_table);
+  auto block_of = make_vector<int>(nstates, 0);
+  auto new_block_of = make_vector<int>(nstates);
+  int nblocks = 1;
+  std::map<std::vector<int>, int> signature_blocks;
+  std::vector<int> signature;
+  while (true) {
+    signature_blocks.clear();
+    for (int state = 0; state < nstates; ++state) {
+      signature.clear();
+      signature.push_back(at(block_of, state));
+      for (int t = 0; t < nterminals; ++t) {
+        auto action = unpack_action(at(p.terminal_table, state, t));
+        if (action.kind == action::kind::shift) {
+          action.next_state = at(block_of, action.next_state);
+        }
+        signature.push_back(pack_action(action));
+      }
+      for (int nt = 0; nt < nnonterminals; ++nt) {
+        auto next_state = at(p.nonterminal_table, state, nt);
+        signature.push_back(next_state == -1 ? -1 : at(block_of, next_state));
+      }
+      auto res = signature_blocks.insert(
+          std::make_pair(signature, int(signature_blocks.size())));
+      at(new_block_of, state) = res.first->second;
+    }
+    block_of.swap(new_block_of);
+    if (int(signature_blocks.size()) == nblocks) break;
+    nblocks = int(signature_blocks.size());
+  }
+  if (nblocks == nstates) return p;
+  shift_reduce_tables out(p.grammar, nblocks);
+  for (int block = 0; block < nblocks; ++block) add_state(out);
+  auto did_block = make_vector<bool>(nblocks, false);
+  for (int state = 0; state < nstates; ++state) {
+    auto block = at(block_of, state);
+    if (at(did_block, block)) continue;
+    at(did_block, block) = true;
+    for (int t = 0; t < nterminals; ++t) {
+      auto action = unpack_action(at(p.terminal_table, state, t));
+      if (action.kind == action::kind::none) continue;
+      if (action.kind == action::kind::shift) {
+        action.next_state = at(block_of, action.next_state);
+      }
+      add_terminal_action(out, block, t, action);
+    }
+    for (int nt = 0; nt < nnonterminals; ++nt) {
+      auto next_state = at(p.nonterminal_table, state, nt);
+      if (next_state == -1) continue;
+      add_nonterminal_action(out, block, nt, at(block_of, next_state));
+    }
+  }
+  return out;
+}
+
+shift_reduce_tables unprune_tables(shift_reduce_tables const& pruned,
+    grammar_ptr grammar, grammar_pruning const& pruning) {
+  auto& pruned_grammar = *(pruned.grammar);
+  auto nstates = get_nstates(pruned);
+  auto out = shift_reduce_tables(grammar, nstates);
+  for (int state = 0; state < nstates; ++state) add_state(out);
+  for (int state = 0; state < nstates; ++state) {
+    for (int t = 0; t < pruned_grammar.nterminals; ++t) {
+      auto action = get_action(pruned, state, t);
+      if (action.kind == action::kind::none) continue;
+      if (action.kind == action::kind::reduce) {
+        action.production = at(pruning.kept_productions, action.production);
+      }
+      add_terminal_action(out, state, at(pruning.kept_symbols, t), action);
+    }
+    for (int nt = 0; nt < get_nnonterminals(pruned_grammar); ++nt) {
+      auto next_state = get_next_state(pruned, state, nt);
+      if (next_state == -1) continue;
+      auto symbol = at(pruning.kept_symbols, pruned_grammar.nterminals + nt);
+      add_nonterminal_action(
+          out, state, as_nonterminal(*grammar, symbol), next_state);
+    }
+  }
+  return out;
+}
+
 }  // end namespace parsegen
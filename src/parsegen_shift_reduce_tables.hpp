@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cassert>
+#include <cstdint>
+#include <memory>
 #include <stack>
 
 #include "parsegen_grammar.hpp"
@@ -21,12 +24,74 @@ struct action {
   };
 };
 
+/* an action as the tables store it: the kind in the low two bits and
+   the next state or production above them, so a cell is 4 bytes and
+   decoding it is a mask and a shift */
+using packed_action = std::int32_t;
+
+inline packed_action pack_action(action const& a) {
+  auto value = (a.kind == action::kind::shift || a.kind == action::kind::reduce)
+                   ? a.production
+                   : 0;
+  assert(0 <= value && value < (1 << 29));
+  return packed_action((value << 2) | int(a.kind));
+}
+
+inline action unpack_action(packed_action packed) {
+  action a;
+  a.kind = static_cast<enum action::kind>(packed & 3);
+  a.production = packed >> 2;
+  return a;
+}
+
+/* the rows of tables that are built the first time a state is
+   entered (see build_lazy_lr1_tables). Rows never move once built,
+   and these may be called from several threads at once. */
+class lazy_rows {
+ public:
+  virtual ~lazy_rows() = default;
+  virtual action get_action(int state, int terminal) const = 0;
+  virtual int get_next_state(int state, int nonterminal) const = 0;
+  /* the number of states built so far */
+  virtual int get_nstates() const = 0;
+};
+
+/* runs of unit reductions precomputed by add_reduce_chains, so a
+   parser can make them without asking the tables after each one */
+struct reduce_chains {
+  /* (state x nonterminal) -> row of chain_rows, or -1 */
+  displaced_table<int> gotos;
+  /* (row x terminal) -> chain, or -1: the chain that (terminal) starts
+     after the goto of the row, defaulting to its most common chain */
+  displaced_table<int> chain_rows;
+  /* the productions of each chain, in the order they are reduced */
+  std::vector<int> offsets;
+  std::vector<int> productions;
+  /* the state each chain leaves on top of (state) */
+  std::vector<int> last_states;
+};
+
+/* how build_lalr1_parser computes the contexts of the reductions in
+   states that are not LR(0)-adequate: with Pager's lane tracing, one
+   reduction at a time, or with DeRemer and Pennello's relations over
+   the nonterminal transitions, all at once. */
+enum class lalr1_method { lane_tracing, deremer_pennello };
+
 struct shift_reduce_tables {
   grammar_ptr grammar;
-  /* (state x terminal) -> action */
-  table<action> terminal_table;
+  /* (state x terminal) -> action, packed */
+  table<packed_action> terminal_table;
   /* (state x non-terminal) -> new state */
   table<int> nonterminal_table;
+  /* if set, the tables above have no rows and these are used instead */
+  std::shared_ptr<lazy_rows const> lazy;
+  /* if compressed (see compress_if_sparse), the tables above have no
+     rows and these are used instead: the terminal table by state, and
+     the nonterminal table by nonterminal, defaulting to the most
+     common next state of each nonterminal */
+  displaced_table<packed_action> terminal_rows;
+  displaced_table<int> nonterminal_columns;
+  reduce_chains chains;
   shift_reduce_tables() = default;
   shift_reduce_tables(grammar_ptr g, int nstates_reserve);
 };
@@ -36,9 +101,35 @@ int get_nstates(shift_reduce_tables const& p);
 void add_terminal_action(shift_reduce_tables& p, int state, int terminal, action action);
 void add_nonterminal_action(
     shift_reduce_tables& p, int state, int nonterminal, int next_state);
-action const& get_action(shift_reduce_tables const& p, int state, int terminal);
+action get_action(shift_reduce_tables const& p, int state, int terminal);
+/* the state after reducing to (nonterminal) in (state), which may be
+   arbitrary if (state) has no transition on it */
+int get_next_state(shift_reduce_tables const& p, int state, int nonterminal);
 int execute_action(
     shift_reduce_tables const& p, std::vector<int>& stack, action const& action);
 grammar_ptr const& get_grammar(shift_reduce_tables const& p);
+/* switches (p) to the row displacement encoding if that takes less
+   than half the memory of the dense tables, which it does for all
+   but the smallest grammars */
+void compress_if_sparse(shift_reduce_tables& p);
+/* precomputes from dense tables, for each goto and lookahead, the
+   unit reductions (those with one symbol on the right) that the
+   lookahead makes one after another once the goto is made. Chains of
+   one reduction are left out, and all are left out if they would take
+   more memory than the dense tables, as with many levels of operator
+   precedence */
+void add_reduce_chains(shift_reduce_tables& p);
+/* the chain made once (nonterminal) is pushed on (state) with
+   lookahead (terminal), or -1 */
+int get_reduce_chain(
+    shift_reduce_tables const& p, int state, int nonterminal, int terminal);
+/* dense tables with the fewest states that parse like (p): states
+   whose rows are the same once equivalent states are identified are
+   merged, as in DFA minimization */
+shift_reduce_tables minimize_states(shift_reduce_tables const& p);
+/* the tables (pruned) built for a grammar that prune_grammar made
+   from (grammar), with the symbols and productions of (grammar) */
+shift_reduce_tables unprune_tables(shift_reduce_tables const& pruned,
+    grammar_ptr grammar, grammar_pruning const& pruning);
 
 }  // namespace parsegen
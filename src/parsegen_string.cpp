@@ -1,5 +1,6 @@
 #include "parsegen_string.hpp"
 
+#include <algorithm>
 #include <stdexcept>
 #include <cctype>
 
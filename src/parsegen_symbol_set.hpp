@@ -0,0 +1,198 @@
+#ifndef PARSEGEN_SYMBOL_SET_HPP
+#define PARSEGEN_SYMBOL_SET_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "parsegen_std_vector.hpp"
+
+namespace parsegen {
+
+/* a set of grammar symbols (small non-negative integers).
+   While it is sparse it is a sorted vector, and once a bitset would
+   take less memory than that it becomes a bitset, so unions and
+   intersections of large sets work a 64-bit word at a time, while
+   the many small sets of a grammar with thousands of terminals stay
+   small. Iteration is in increasing order either way. */
+class symbol_set {
+ public:
+  using word = std::uint64_t;
+  enum { WORD_BITS = 64 };
+  class const_iterator {
+   public:
+    const_iterator(symbol_set const* set_in, int pos_in)
+        : set(set_in), pos(pos_in) {}
+    int operator*() const {
+      return set->is_dense ? pos : at(set->elements, pos);
+    }
+    const_iterator& operator++() {
+      pos = set->is_dense ? set->find_next(pos + 1) : pos + 1;
+      return *this;
+    }
+    bool operator==(const_iterator const& other) const {
+      return pos == other.pos;
+    }
+    bool operator!=(const_iterator const& other) const {
+      return pos != other.pos;
+    }
+
+   private:
+    symbol_set const* set;
+    /* the element itself when dense, its index when sparse */
+    int pos;
+  };
+  const_iterator begin() const {
+    return const_iterator(this, is_dense ? find_next(0) : 0);
+  }
+  const_iterator end() const {
+    return const_iterator(this, is_dense ? get_nbits() : isize(elements));
+  }
+  bool empty() const { return begin() == end(); }
+  int size() const {
+    if (!is_dense) return isize(elements);
+    int n = 0;
+    for (auto w : words) n += count_bits(w);
+    return n;
+  }
+  bool contains(int symbol) const {
+    assert(0 <= symbol);
+    if (!is_dense) {
+      return std::binary_search(elements.begin(), elements.end(), symbol);
+    }
+    if (symbol >= get_nbits()) return false;
+    return (at(words, symbol / WORD_BITS) >> (symbol % WORD_BITS)) & 1;
+  }
+  void insert(int symbol) {
+    assert(0 <= symbol);
+    if (is_dense) {
+      set_bit(symbol);
+      return;
+    }
+    auto it = std::lower_bound(elements.begin(), elements.end(), symbol);
+    if (it != elements.end() && *it == symbol) return;
+    elements.insert(it, symbol);
+    densify_if_smaller();
+  }
+  friend void unite_with(symbol_set& a, symbol_set const& b);
+  friend void subtract_from(symbol_set& a, symbol_set const& b);
+  friend bool intersects(symbol_set const& a, symbol_set const& b);
+
+ private:
+  std::vector<int> elements;
+  std::vector<word> words;
+  bool is_dense = false;
+  int get_nbits() const { return isize(words) * WORD_BITS; }
+  static int count_bits(word w) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(w);
+#else
+    int n = 0;
+    for (; w; w &= w - 1) ++n;
+    return n;
+#endif
+  }
+  static int count_trailing_zeros(word w) {
+    assert(w != 0);
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(w);
+#else
+    int n = 0;
+    for (; !(w & 1); w >>= 1) ++n;
+    return n;
+#endif
+  }
+  /* the first element at least (from), or get_nbits() if none */
+  int find_next(int from) const {
+    auto nbits = get_nbits();
+    if (from >= nbits) return nbits;
+    auto i = from / WORD_BITS;
+    auto w = at(words, i) & (~word(0) << (from % WORD_BITS));
+    while (w == 0) {
+      if (++i == isize(words)) return nbits;
+      w = at(words, i);
+    }
+    return i * WORD_BITS + count_trailing_zeros(w);
+  }
+  void grow(int nwords) {
+    if (isize(words) < nwords) words.resize(std::size_t(nwords), 0);
+  }
+  void set_bit(int symbol) {
+    grow(symbol / WORD_BITS + 1);
+    at(words, symbol / WORD_BITS) |= word(1) << (symbol % WORD_BITS);
+  }
+  void densify() {
+    if (is_dense) return;
+    is_dense = true;
+    words.clear();
+    if (!elements.empty()) grow(elements.back() / WORD_BITS + 1);
+    for (auto symbol : elements) set_bit(symbol);
+    elements.clear();
+    elements.shrink_to_fit();
+  }
+  void densify_if_smaller() {
+    if (elements.empty()) return;
+    auto dense_bits = (elements.back() / WORD_BITS + 1) * WORD_BITS;
+    auto sparse_bits = isize(elements) * int(sizeof(int)) * 8;
+    if (sparse_bits >= dense_bits) densify();
+  }
+};
+
+inline void unite_with(symbol_set& a, symbol_set const& b) {
+  if (b.is_dense) {
+    a.densify();
+    a.grow(isize(b.words));
+    for (int i = 0; i < isize(b.words); ++i) at(a.words, i) |= at(b.words, i);
+    return;
+  }
+  if (b.elements.empty()) return;
+  if (a.is_dense) {
+    for (auto symbol : b.elements) a.set_bit(symbol);
+    return;
+  }
+  std::vector<int> merged;
+  merged.reserve(a.elements.size() + b.elements.size());
+  std::set_union(a.elements.begin(), a.elements.end(), b.elements.begin(),
+      b.elements.end(), std::back_inserter(merged));
+  a.elements.swap(merged);
+  a.densify_if_smaller();
+}
+
+inline void subtract_from(symbol_set& a, symbol_set const& b) {
+  if (a.is_dense && b.is_dense) {
+    auto n = std::min(isize(a.words), isize(b.words));
+    for (int i = 0; i < n; ++i) at(a.words, i) &= ~at(b.words, i);
+  } else if (a.is_dense) {
+    for (auto symbol : b.elements) {
+      if (symbol < a.get_nbits()) {
+        at(a.words, symbol / symbol_set::WORD_BITS) &=
+            ~(symbol_set::word(1) << (symbol % symbol_set::WORD_BITS));
+      }
+    }
+  } else {
+    a.elements.erase(std::remove_if(a.elements.begin(), a.elements.end(),
+                         [&](int symbol) { return b.contains(symbol); }),
+        a.elements.end());
+  }
+}
+
+inline bool intersects(symbol_set const& a, symbol_set const& b) {
+  if (a.is_dense && b.is_dense) {
+    auto n = std::min(isize(a.words), isize(b.words));
+    for (int i = 0; i < n; ++i) {
+      if (at(a.words, i) & at(b.words, i)) return true;
+    }
+    return false;
+  }
+  if (a.is_dense) return intersects(b, a);
+  for (auto symbol : a.elements) {
+    if (b.contains(symbol)) return true;
+  }
+  return false;
+}
+
+}  // namespace parsegen
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef PARSEGEN_TABLE_HPP
 #define PARSEGEN_TABLE_HPP
 
+#include <algorithm>
+#include <utility>
+
 #include "parsegen_std_vector.hpp"
 
 namespace parsegen {
@@ -55,6 +58,89 @@ typename table<T>::const_reference at(table<T> const& t, int row, int col) {
   return parsegen::at(t.data, row * t.ncols + col);
 }
 
+/* a sparse table with its rows overlaid in one vector
+   ("row displacement" or "comb vector" encoding).
+   The entry for (row, col) is entries[offsets[row] + col] if
+   checks[offsets[row] + col] == col, and defaults[row] otherwise.
+   Rows with the same entries share an offset, any other two rows
+   have different offsets, so a column check is enough. */
+template <typename T>
+struct displaced_table {
+  std::vector<int> offsets;
+  std::vector<T> entries;
+  std::vector<int> checks;
+  std::vector<T> defaults;
+};
+
+/* (rows) lists the (col, entry) pairs of each row that differ from its
+   default, sorted by column. Rows are placed largest first, each at
+   the first offset where its entries fit. */
+template <typename T>
+displaced_table<T> make_displaced_table(int ncols,
+    std::vector<std::vector<std::pair<int, T>>> const& rows,
+    std::vector<T> const& defaults) {
+  displaced_table<T> out;
+  out.defaults = defaults;
+  auto nrows = isize(rows);
+  out.offsets = make_vector<int>(nrows, -1);
+  auto order = make_vector<int>(nrows);
+  for (int row = 0; row < nrows; ++row) at(order, row) = row;
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return at(rows, a).size() > at(rows, b).size();
+  });
+  std::vector<bool> is_taken_offset;
+  int first_free = 0;
+  for (int i = 0; i < nrows; ++i) {
+    auto row = at(order, i);
+    auto& cells = at(rows, row);
+    /* equal rows are among the ones of the same size placed before */
+    for (int j = i - 1; j >= 0; --j) {
+      auto other = at(order, j);
+      if (at(rows, other).size() != cells.size()) break;
+      if (at(rows, other) == cells) {
+        at(out.offsets, row) = at(out.offsets, other);
+        break;
+      }
+    }
+    if (at(out.offsets, row) != -1) continue;
+    auto fits = [&](int offset) {
+      if (offset < isize(is_taken_offset) && at(is_taken_offset, offset)) {
+        return false;
+      }
+      for (auto& cell : cells) {
+        auto k = offset + cell.first;
+        if (k < isize(out.checks) && at(out.checks, k) != -1) return false;
+      }
+      return true;
+    };
+    auto offset =
+        cells.empty() ? 0 : std::max(0, first_free - cells.front().first);
+    while (!fits(offset)) ++offset;
+    at(out.offsets, row) = offset;
+    if (isize(is_taken_offset) <= offset) resize(is_taken_offset, offset + 1);
+    at(is_taken_offset, offset) = true;
+    if (isize(out.checks) < offset + ncols) {
+      out.checks.resize(std::size_t(offset + ncols), -1);
+      out.entries.resize(std::size_t(offset + ncols), at(defaults, row));
+    }
+    for (auto& cell : cells) {
+      at(out.checks, offset + cell.first) = cell.first;
+      at(out.entries, offset + cell.first) = cell.second;
+    }
+    while (first_free < isize(out.checks) && at(out.checks, first_free) != -1) {
+      ++first_free;
+    }
+  }
+  return out;
+}
+
+template <typename T>
+T const& at(displaced_table<T> const& t, int row, int col) {
+  auto k = at(t.offsets, row) + col;
+  if (at(t.checks, k) == col) return at(t.entries, k);
+  return at(t.defaults, row);
+}
+
 }  // namespace parsegen
 
 #endif
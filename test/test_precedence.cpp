@@ -0,0 +1,119 @@
+#include <iostream>
+#include <string>
+
+#include "parsegen.hpp"
+#include "parsegen_build_parser.hpp"
+
+/* a flat expression grammar (expr ::= expr op expr) that is only
+   LALR(1) because of its precedence levels */
+
+namespace {
+
+enum {
+  PROD_TOP,
+  PROD_ADD,
+  PROD_SUBTRACT,
+  PROD_MULTIPLY,
+  PROD_POWER,
+  PROD_LESS,
+  PROD_NEGATE,
+  PROD_PARENS,
+  PROD_NUMBER
+};
+
+int nfailures = 0;
+
+void check(bool condition, std::string const& what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << '\n';
+    ++nfailures;
+  }
+}
+
+/* parses to the input with every reduction of an operator
+   parenthesized, so the parse tree can be compared as a string */
+class tree_parser : public parsegen::parser {
+ public:
+  tree_parser(parsegen::parser_tables_ptr tables_in)
+      : parsegen::parser(tables_in) {}
+
+ protected:
+  virtual std::any shift(int, std::string& text) override { return text; }
+  virtual std::any reduce(int production, std::vector<std::any>& rhs) override {
+    auto text = [&](int i) { return std::any_cast<std::string&>(rhs.at(i)); };
+    switch (production) {
+      case PROD_NEGATE:
+        return "(-" + text(1) + ")";
+      case PROD_PARENS:
+        return text(1);
+      case PROD_TOP:
+      case PROD_NUMBER:
+        return text(0);
+    }
+    return "(" + text(0) + text(1) + text(2) + ")";
+  }
+};
+
+parsegen::language make_flat_language() {
+  parsegen::language l;
+  l.tokens = {{"ws", "[ ]+"}, {"num", "[0-9]+"}, {"+", "\\+"}, {"-", "\\-"},
+      {"*", "\\*"}, {"^", "\\^"}, {"<", "<"}, {"(", "\\("}, {")", "\\)"}};
+  l.ignored_tokens = {"ws"};
+  l.productions = {{"top", {"expr"}}, {"expr", {"expr", "+", "expr"}},
+      {"expr", {"expr", "-", "expr"}}, {"expr", {"expr", "*", "expr"}},
+      {"expr", {"expr", "^", "expr"}}, {"expr", {"expr", "<", "expr"}},
+      {"expr", {"-", "expr"}, "NEG"}, {"expr", {"(", "expr", ")"}},
+      {"expr", {"num"}}};
+  l.precedence_levels = {{parsegen::associativity::nonassoc, {"<"}},
+      {parsegen::associativity::left, {"+", "-"}},
+      {parsegen::associativity::left, {"*"}},
+      /* a tag, not a token: only the unary minus names it */
+      {parsegen::associativity::right, {"NEG"}},
+      {parsegen::associativity::right, {"^"}}};
+  return l;
+}
+
+void check_parses(parsegen::parser_tables_ptr tables, std::string const& mode) {
+  struct example {
+    char const* input;
+    char const* tree;
+  };
+  example const examples[] = {{"1 + 2 * 3", "(1+(2*3))"},
+      {"1 - 2 - 3", "((1-2)-3)"}, {"2 ^ 3 ^ 4", "(2^(3^4))"},
+      {"-2 ^ 2", "(-(2^2))"}, {"-1 * 2", "((-1)*2)"},
+      {"1 + 2 < 3 * 4", "((1+2)<(3*4))"}, {"(1 + 2) * 3", "((1+2)*3)"}};
+  for (auto const& e : examples) {
+    tree_parser parser(tables);
+    std::string tree;
+    try {
+      tree = std::any_cast<std::string>(parser.parse_string(e.input, "test"));
+    } catch (parsegen::error const&) {
+      tree = "an error";
+    }
+    check(tree == e.tree, mode + ": \"" + e.input + "\" parsed to " + tree +
+                              " instead of " + e.tree);
+  }
+  /* < is nonassociative, so it cannot be chained */
+  tree_parser parser(tables);
+  bool rejected = false;
+  try {
+    parser.parse_string("1 < 2 < 3", "test");
+  } catch (parsegen::error const&) {
+    rejected = true;
+  }
+  check(rejected, mode + ": \"1 < 2 < 3\" was accepted");
+}
+
+}  // namespace
+
+int main() {
+  auto language = make_flat_language();
+  auto tables = parsegen::build_parser_tables(language);
+  check_parses(tables, "LALR(1)");
+  auto deremer_pennello = parsegen::build_parser_tables(
+      language, false, parsegen::lalr1_method::deremer_pennello);
+  check_parses(deremer_pennello, "DeRemer-Pennello LALR(1)");
+  auto lazy = parsegen::build_lazy_parser_tables(language);
+  check_parses(lazy, "lazy LR(1)");
+  return nfailures == 0 ? 0 : 1;
+}
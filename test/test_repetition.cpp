@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "parsegen.hpp"
+
+/* the repetition operators X*, X+ and X? and the values the parser
+   makes for them (see builtin_reduction) */
+
+namespace {
+
+enum { TOK_WHITESPACE, TOK_NUMBER, TOK_LBRACE, TOK_RBRACE, TOK_LBRACKET,
+  TOK_RBRACKET, TOK_LPAREN, TOK_RPAREN, TOK_BANG };
+
+enum { PROD_TOP, PROD_ANY_NUMBERS, PROD_SOME_NUMBERS };
+
+int nfailures = 0;
+
+void check(bool condition, std::string const& what) {
+  if (!condition) {
+    std::cerr << "FAILED: " << what << '\n';
+    ++nfailures;
+  }
+}
+
+parsegen::language make_repetition_language() {
+  parsegen::language l;
+  l.tokens = {{"ws", "[ ]+"}, {"num", "[0-9]+"}, {"{", "\\{"}, {"}", "\\}"},
+      {"[", "\\["}, {"]", "\\]"}, {"(", "\\("}, {")", "\\)"}, {"!", "!"}};
+  l.ignored_tokens = {"ws"};
+  l.productions = {{"top", {"{", "group*", "}"}},
+      {"group", {"[", "num*", "]", "!?"}}, {"group", {"(", "num+", ")"}}};
+  return l;
+}
+
+std::string join(std::vector<std::any>& values) {
+  std::string out;
+  for (auto& value : values) {
+    if (!out.empty()) out += ",";
+    out += std::any_cast<std::string&>(value);
+  }
+  return out;
+}
+
+/* checks the type of each list and optional value it is given,
+   and describes the groups as a string, e.g. "[1,2]! (3)" */
+class list_parser : public parsegen::parser {
+ public:
+  list_parser(parsegen::parser_tables_ptr tables_in)
+      : parsegen::parser(tables_in) {}
+  int max_stack_size = 0;
+
+ protected:
+  virtual std::any shift(int token, std::string& text) override {
+    max_stack_size = std::max(max_stack_size, int(value_stack.size()));
+    if (token == TOK_NUMBER) return text;
+    if (token == TOK_BANG) return std::string("!");
+    return std::any();
+  }
+  virtual std::any reduce(int production, std::vector<std::any>& rhs) override {
+    switch (production) {
+      case PROD_TOP: {
+        std::string out;
+        for (auto& group : std::any_cast<std::vector<std::any>&>(rhs.at(1))) {
+          if (!out.empty()) out += " ";
+          out += std::any_cast<std::string&>(group);
+        }
+        return out;
+      }
+      case PROD_ANY_NUMBERS: {
+        auto& numbers = std::any_cast<std::vector<std::any>&>(rhs.at(1));
+        auto& bang = rhs.at(3);
+        std::string out = "[" + join(numbers) + "]";
+        if (bang.has_value()) out += std::any_cast<std::string&>(bang);
+        return out;
+      }
+      case PROD_SOME_NUMBERS: {
+        auto& numbers = std::any_cast<std::vector<std::any>&>(rhs.at(1));
+        return "(" + join(numbers) + ")";
+      }
+    }
+    return std::any();
+  }
+};
+
+}  // namespace
+
+int main() {
+  auto tables = parsegen::build_parser_tables(make_repetition_language());
+  struct example {
+    char const* input;
+    char const* value;
+  };
+  example const examples[] = {{"{}", ""}, {"{[]}", "[]"}, {"{[]!}", "[]!"},
+      {"{[7]}", "[7]"}, {"{[1 2 3]!}", "[1,2,3]!"}, {"{(4)}", "(4)"},
+      {"{(4 5 6)}", "(4,5,6)"}, {"{[1] (2 3) []!}", "[1] (2,3) []!"}};
+  for (auto const& e : examples) {
+    list_parser parser(tables);
+    std::string value;
+    try {
+      value = std::any_cast<std::string>(parser.parse_string(e.input, "test"));
+    } catch (parsegen::error const&) {
+      value = "an error";
+    }
+    check(value == e.value, std::string("\"") + e.input + "\" parsed to \"" +
+                                value + "\" instead of \"" + e.value + "\"");
+  }
+  /* X+ needs at least one X */
+  {
+    list_parser parser(tables);
+    bool rejected = false;
+    try {
+      parser.parse_string("{()}", "test");
+    } catch (parsegen::error const&) {
+      rejected = true;
+    }
+    check(rejected, "\"{()}\" was accepted");
+  }
+  /* the lists are left recursive, so the stack stays shallow however
+     many items they have */
+  {
+    std::string input = "{";
+    std::string expected;
+    for (int i = 0; i < 10000; ++i) {
+      input += "[" + std::to_string(i) + " 0]";
+      if (i) expected += " ";
+      expected += "[" + std::to_string(i) + ",0]";
+    }
+    input += "}";
+    list_parser parser(tables);
+    auto value = std::any_cast<std::string>(parser.parse_string(input, "test"));
+    check(value == expected, "10000 groups parsed to the wrong value");
+    check(parser.max_stack_size < 10,
+        "10000 groups needed a stack of " +
+            std::to_string(parser.max_stack_size));
+  }
+  return nfailures == 0 ? 0 : 1;
+}